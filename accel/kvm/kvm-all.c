@@ -74,6 +74,12 @@
 /* Default max allowed memslots if kernel reported nothing */
 #define  KVM_MEMSLOTS_NR_MAX_DEFAULT                        32
 
+/* Max threads collecting the dirty rings, and vCPUs worth one more */
+#define  KVM_DIRTY_RING_MAX_THREADS                         64
+#define  KVM_DIRTY_RING_VCPUS_PER_THREAD                    64
+/* Host pages of a KVMSlot bitmap merged at once, a multiple of 64 */
+#define  KVM_DIRTY_RING_MERGE_PAGES                         (1UL << 18)
+
 struct KVMParkedVcpu {
     unsigned long vcpu_id;
     int kvm_fd;
@@ -702,6 +708,22 @@ static void kvm_slot_reset_dirty_pages(KVMSlot *slot)
     memset(slot->dirty_bmap, 0, slot->dirty_bmap_size);
 }
 
+/*
+ * Same as kvm_slot_sync_dirty_pages() followed by
+ * kvm_slot_reset_dirty_pages(), for @npages host pages starting at
+ * @first, which must be a multiple of 64.
+ */
+static void kvm_slot_sync_dirty_range(KVMSlot *slot, ram_addr_t first,
+                                      ram_addr_t npages)
+{
+    unsigned long *bmap = slot->dirty_bmap + BIT_WORD(first);
+    ram_addr_t start = slot->ram_start_offset +
+                       first * qemu_real_host_page_size();
+
+    cpu_physical_memory_set_dirty_lebitmap(bmap, start, npages);
+    memset(bmap, 0, BITS_TO_LONGS(npages) * sizeof(unsigned long));
+}
+
 #define ALIGN(x, y)  (((x)+(y)-1) & ~((y)-1))
 
 /* Allocate the dirty bitmap for a slot  */
@@ -760,7 +782,8 @@ static bool kvm_slot_get_dirty_log(KVMState *s, KVMSlot *slot)
 
 /* Should be with all slots_lock held for the address spaces. */
 static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
-                                     uint32_t slot_id, uint64_t offset)
+                                     uint32_t slot_id, uint64_t offset,
+                                     bool atomic)
 {
     KVMMemoryListener *kml;
     KVMSlot *mem;
@@ -777,7 +800,11 @@ static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
         return;
     }
 
-    set_bit(offset, mem->dirty_bmap);
+    if (atomic) {
+        set_bit_atomic(offset, mem->dirty_bmap);
+    } else {
+        set_bit(offset, mem->dirty_bmap);
+    }
 }
 
 static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
@@ -812,9 +839,11 @@ static void dirty_gfn_set_collected(struct kvm_dirty_gfn *gfn)
 
 /*
  * Should be with all slots_lock held for the address spaces.  It returns the
- * dirty page we've collected on this dirty ring.
+ * dirty page we've collected on this dirty ring.  @atomic must be set if
+ * other rings are reaped at the same time.
  */
-static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
+static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu,
+                                        bool atomic)
 {
     struct kvm_dirty_gfn *dirty_gfns = cpu->kvm_dirty_gfns, *cur;
     uint32_t ring_size = s->kvm_dirty_ring_size;
@@ -838,7 +867,7 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
             break;
         }
         kvm_dirty_ring_mark_page(s, cur->slot >> 16, cur->slot & 0xffff,
-                                 cur->offset);
+                                 cur->offset, atomic);
         dirty_gfn_set_collected(cur);
         trace_kvm_dirty_ring_page(cpu->cpu_index, fetch, cur->offset);
         fetch++;
@@ -850,6 +879,56 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
     return count;
 }
 
+/*
+ * Run @job split between the reaper helpers and the calling thread, and
+ * return the sum of what each part returned.  Only the caller runs it if
+ * @parallel is false.  Must be with slots_lock held.
+ */
+static uint64_t kvm_dirty_ring_run(KVMState *s, KVMDirtyRingJob job,
+                                   void *opaque, bool parallel)
+{
+    struct KVMDirtyRingReaper *r = &s->reaper;
+    uint64_t total;
+    int i;
+
+    if (!parallel || r->nr_threads <= 1) {
+        return job(s, opaque, 0, 1);
+    }
+
+    r->job = job;
+    r->job_opaque = opaque;
+    for (i = 0; i < r->nr_threads - 1; i++) {
+        qemu_sem_post(&r->workers[i].sem);
+    }
+
+    total = job(s, opaque, 0, r->nr_threads);
+
+    for (i = 0; i < r->nr_threads - 1; i++) {
+        qemu_sem_wait(&r->workers_done);
+    }
+    for (i = 0; i < r->nr_threads - 1; i++) {
+        total += r->workers[i].total;
+    }
+
+    return total;
+}
+
+static uint64_t kvm_dirty_ring_reap_job(KVMState *s, void *opaque,
+                                        int index, int nr)
+{
+    CPUState *cpu;
+    uint64_t total = 0;
+    int i = 0;
+
+    CPU_FOREACH(cpu) {
+        if (i++ % nr == index) {
+            total += kvm_dirty_ring_reap_one(s, cpu, nr > 1);
+        }
+    }
+
+    return total;
+}
+
 /* Must be with slots_lock held */
 static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
 {
@@ -860,11 +939,9 @@ static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
     stamp = get_clock();
 
     if (cpu) {
-        total = kvm_dirty_ring_reap_one(s, cpu);
+        total = kvm_dirty_ring_reap_one(s, cpu, false);
     } else {
-        CPU_FOREACH(cpu) {
-            total += kvm_dirty_ring_reap_one(s, cpu);
-        }
+        total = kvm_dirty_ring_run(s, kvm_dirty_ring_reap_job, NULL, true);
     }
 
     if (total) {
@@ -1594,10 +1671,65 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
     g_assert_not_reached();
 }
 
-static void kvm_dirty_ring_reaper_init(KVMState *s)
+static void *kvm_dirty_ring_worker_thread(void *data)
 {
+    KVMDirtyRingWorker *w = data;
+    KVMState *s = kvm_state;
     struct KVMDirtyRingReaper *r = &s->reaper;
 
+    rcu_register_thread();
+
+    while (true) {
+        qemu_sem_wait(&w->sem);
+        WITH_RCU_READ_LOCK_GUARD() {
+            w->total = r->job(s, r->job_opaque, w->index + 1, r->nr_threads);
+        }
+        qemu_sem_post(&r->workers_done);
+    }
+
+    g_assert_not_reached();
+}
+
+static int kvm_dirty_ring_reap_threads(KVMState *s, int max_cpus)
+{
+    long host_procs = sysconf(_SC_NPROCESSORS_ONLN);
+    int ret = 1;
+
+    if (s->kvm_dirty_ring_reap_threads) {
+        return s->kvm_dirty_ring_reap_threads;
+    }
+
+    if (host_procs > 0) {
+        ret = MIN(MIN(host_procs, KVM_DIRTY_RING_MAX_THREADS),
+                  DIV_ROUND_UP(max_cpus, KVM_DIRTY_RING_VCPUS_PER_THREAD));
+    }
+
+    /* In case sysconf() fails, we fall back to single threaded */
+    return ret;
+}
+
+static void kvm_dirty_ring_reaper_init(KVMState *s, int max_cpus)
+{
+    struct KVMDirtyRingReaper *r = &s->reaper;
+    int i;
+
+    r->nr_threads = kvm_dirty_ring_reap_threads(s, max_cpus);
+    trace_kvm_dirty_ring_reaper_init(r->nr_threads);
+
+    if (r->nr_threads > 1) {
+        qemu_sem_init(&r->workers_done, 0);
+        r->workers = g_new0(KVMDirtyRingWorker, r->nr_threads - 1);
+        for (i = 0; i < r->nr_threads - 1; i++) {
+            KVMDirtyRingWorker *w = &r->workers[i];
+            g_autofree char *name = g_strdup_printf("kvm-reaper-%d", i + 1);
+
+            w->index = i;
+            qemu_sem_init(&w->sem, 0);
+            qemu_thread_create(&w->thread, name, kvm_dirty_ring_worker_thread,
+                               w, QEMU_THREAD_JOINABLE);
+        }
+    }
+
     qemu_thread_create(&r->reaper_thr, "kvm-reaper",
                        kvm_dirty_ring_reaper_thread,
                        s, QEMU_THREAD_JOINABLE);
@@ -1771,6 +1903,40 @@ static void kvm_log_sync(MemoryListener *listener,
     kvm_slots_unlock();
 }
 
+/*
+ * Merge the KVMSlot dirty bitmaps of a listener into the ram_list ones,
+ * in chunks of KVM_DIRTY_RING_MERGE_PAGES so that large slots are shared
+ * between threads too.
+ */
+static uint64_t kvm_dirty_ring_merge_job(KVMState *s, void *opaque,
+                                         int index, int nr)
+{
+    KVMMemoryListener *kml = opaque;
+    uint64_t n = 0;
+    KVMSlot *mem;
+    int i;
+
+    for (i = 0; i < kml->nr_slots_allocated; i++) {
+        ram_addr_t first, pages;
+
+        mem = &kml->slots[i];
+        if (!mem->memory_size || !(mem->flags & KVM_MEM_LOG_DIRTY_PAGES)) {
+            continue;
+        }
+
+        pages = mem->memory_size / qemu_real_host_page_size();
+        for (first = 0; first < pages; first += KVM_DIRTY_RING_MERGE_PAGES) {
+            if (n++ % nr == index) {
+                kvm_slot_sync_dirty_range(mem, first,
+                                          MIN(KVM_DIRTY_RING_MERGE_PAGES,
+                                              pages - first));
+            }
+        }
+    }
+
+    return 0;
+}
+
 static void kvm_log_sync_global(MemoryListener *l, bool last_stage)
 {
     KVMMemoryListener *kml = container_of(l, KVMMemoryListener, listener);
@@ -1782,22 +1948,25 @@ static void kvm_log_sync_global(MemoryListener *l, bool last_stage)
     kvm_dirty_ring_flush();
 
     kvm_slots_lock();
-    for (i = 0; i < kml->nr_slots_allocated; i++) {
-        mem = &kml->slots[i];
-        if (mem->memory_size && mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
-            kvm_slot_sync_dirty_pages(mem);
+    /*
+     * The slot bitmaps are cleared while merging them.  This is not needed
+     * by KVM_GET_DIRTY_LOG because the ioctl will unconditionally overwrite
+     * the whole region.  However kvm dirty ring has no such side effect.
+     *
+     * The dirty rate measurement counts pages in a plain global, so
+     * do not merge in parallel while it runs.
+     */
+    kvm_dirty_ring_run(s, kvm_dirty_ring_merge_job, kml,
+                       !(global_dirty_tracking & GLOBAL_DIRTY_DIRTY_RATE));
 
-            if (s->kvm_dirty_ring_with_bitmap && last_stage &&
+    if (s->kvm_dirty_ring_with_bitmap && last_stage) {
+        for (i = 0; i < kml->nr_slots_allocated; i++) {
+            mem = &kml->slots[i];
+            if (mem->memory_size && mem->flags & KVM_MEM_LOG_DIRTY_PAGES &&
                 kvm_slot_get_dirty_log(s, mem)) {
                 kvm_slot_sync_dirty_pages(mem);
+                kvm_slot_reset_dirty_pages(mem);
             }
-
-            /*
-             * This is not needed by KVM_GET_DIRTY_LOG because the
-             * ioctl will unconditionally overwrite the whole region.
-             * However kvm dirty ring has no such side effect.
-             */
-            kvm_slot_reset_dirty_pages(mem);
         }
     }
     kvm_slots_unlock();
@@ -2750,7 +2919,7 @@ static int kvm_init(MachineState *ms)
     }
 
     if (s->kvm_dirty_ring_size) {
-        kvm_dirty_ring_reaper_init(s);
+        kvm_dirty_ring_reaper_init(s, ms->smp.max_cpus);
     }
 
     if (kvm_check_extension(kvm_state, KVM_CAP_BINARY_STATS_FD)) {
@@ -3880,6 +4049,40 @@ static void kvm_set_dirty_ring_size(Object *obj, Visitor *v,
     s->kvm_dirty_ring_size = value;
 }
 
+static void kvm_get_dirty_ring_reap_threads(Object *obj, Visitor *v,
+                                            const char *name, void *opaque,
+                                            Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value = s->kvm_dirty_ring_reap_threads;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void kvm_set_dirty_ring_reap_threads(Object *obj, Visitor *v,
+                                            const char *name, void *opaque,
+                                            Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value;
+
+    if (s->fd != -1) {
+        error_setg(errp, "Cannot set properties after the accelerator has been initialized");
+        return;
+    }
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value > KVM_DIRTY_RING_MAX_THREADS) {
+        error_setg(errp, "dirty-ring-reap-threads must be at most %d.",
+                   KVM_DIRTY_RING_MAX_THREADS);
+        return;
+    }
+
+    s->kvm_dirty_ring_reap_threads = value;
+}
+
 static char *kvm_get_device(Object *obj,
                             Error **errp G_GNUC_UNUSED)
 {
@@ -3924,6 +4127,7 @@ static void kvm_accel_instance_init(Object *obj)
     s->kernel_irqchip_split = ON_OFF_AUTO_AUTO;
     /* KVM dirty ring is by default off */
     s->kvm_dirty_ring_size = 0;
+    s->kvm_dirty_ring_reap_threads = 0;
     s->kvm_dirty_ring_with_bitmap = false;
     s->kvm_eager_split_size = 0;
     s->notify_vmexit = NOTIFY_VMEXIT_OPTION_RUN;
@@ -3973,6 +4177,12 @@ static void kvm_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "dirty-ring-size",
         "Size of KVM dirty page ring buffer (default: 0, i.e. use bitmap)");
 
+    object_class_property_add(oc, "dirty-ring-reap-threads", "uint32",
+        kvm_get_dirty_ring_reap_threads, kvm_set_dirty_ring_reap_threads,
+        NULL, NULL);
+    object_class_property_set_description(oc, "dirty-ring-reap-threads",
+        "Threads collecting KVM dirty rings (default: 0, i.e. automatic)");
+
     object_class_property_add_str(oc, "device", kvm_get_device, kvm_set_device);
     object_class_property_set_description(oc, "device",
         "Path to the device node to use (default: /dev/kvm)");
@@ -28,6 +28,8 @@
 #include "block/aio_task.h"
 #include "qemu/error-report.h"
 #include "qemu/memalign.h"
+#include "qemu/stats64.h"
+#include "qemu/timer.h"
 
 #define BLOCK_COPY_MAX_COPY_RANGE (16 * MiB)
 #define BLOCK_COPY_MAX_BUFFER (1 * MiB)
@@ -35,6 +37,7 @@
 #define BLOCK_COPY_MAX_WORKERS 64
 #define BLOCK_COPY_SLICE_TIME 100000000ULL /* ns */
 #define BLOCK_COPY_CLUSTER_SIZE_DEFAULT (1 << 16)
+#define BLOCK_COPY_MAX_COPY_RANGE_FAILURES 8
 
 typedef enum {
     COPY_READ_WRITE_CLUSTER,
@@ -44,6 +47,25 @@ typedef enum {
     COPY_RANGE_FULL
 } BlockCopyMethod;
 
+/*
+ * Tasks are run in separate pools depending on whether they go through a
+ * bounce buffer, so that cheap offloaded requests are not held back by
+ * memory-bound buffered copies and vice versa.  Both pools draw from the
+ * caller's max_workers, see block_copy_wait_worker().
+ */
+typedef enum {
+    BLOCK_COPY_POOL_OFFLOAD,
+    BLOCK_COPY_POOL_BOUNCE,
+    BLOCK_COPY_POOL__MAX
+} BlockCopyPool;
+
+/* Boundaries of the per-task latency histograms, in nanoseconds */
+static const uint64_t block_copy_latency_boundaries[] = {
+    100 * SCALE_US, SCALE_MS, 10 * SCALE_MS, 100 * SCALE_MS,
+    NANOSECONDS_PER_SECOND,
+};
+#define BLOCK_COPY_LATENCY_BINS (ARRAY_SIZE(block_copy_latency_boundaries) + 1)
+
 static coroutine_fn int block_copy_task_entry(AioTask *task);
 
 typedef struct BlockCopyCallState {
@@ -58,6 +80,8 @@ typedef struct BlockCopyCallState {
     void *cb_opaque;
     /* Coroutine where async block-copy is running */
     Coroutine *co;
+    /* Number of tasks of this call running in each pool */
+    int workers[BLOCK_COPY_POOL__MAX];
 
     /* Fields whose state changes throughout the execution */
     bool finished; /* atomic */
@@ -137,6 +161,12 @@ typedef struct BlockCopyState {
     CoMutex lock;
     int64_t in_flight_bytes;
     BlockCopyMethod method;
+    /*
+     * Number of consecutive failed copy_range requests.  A failing region
+     * falls back to buffered copying on its own; copy_range is only disabled
+     * altogether once this reaches BLOCK_COPY_MAX_COPY_RANGE_FAILURES.
+     */
+    int copy_range_failures;
     bool discard_source;
     BlockReqList reqs;
     QLIST_HEAD(, BlockCopyCallState) calls;
@@ -160,8 +190,34 @@ typedef struct BlockCopyState {
     ProgressMeter *progress;
     SharedResource *mem;
     RateLimit rate_limit;
+    Stat64 latency[BLOCK_COPY_POOL__MAX][BLOCK_COPY_LATENCY_BINS];
 } BlockCopyState;
 
+static BlockCopyPool block_copy_method_pool(BlockCopyMethod method)
+{
+    switch (method) {
+    case COPY_WRITE_ZEROES:
+    case COPY_RANGE_SMALL:
+    case COPY_RANGE_FULL:
+        return BLOCK_COPY_POOL_OFFLOAD;
+    default:
+        return BLOCK_COPY_POOL_BOUNCE;
+    }
+}
+
+static void block_copy_account_latency(BlockCopyState *s, BlockCopyPool pool,
+                                       int64_t latency_ns)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(block_copy_latency_boundaries); i++) {
+        if (latency_ns < block_copy_latency_boundaries[i]) {
+            break;
+        }
+    }
+    stat64_add(&s->latency[pool][i], 1);
+}
+
 /* Called with lock held */
 static int64_t block_copy_chunk_size(BlockCopyState *s)
 {
@@ -474,7 +530,9 @@ static coroutine_fn int block_copy_task_run(AioTaskPool *pool,
 
     aio_task_pool_wait_slot(pool);
     if (aio_task_pool_status(pool) < 0) {
-        co_put_to_shres(task->s->mem, task->req.bytes);
+        if (block_copy_method_pool(task->method) == BLOCK_COPY_POOL_BOUNCE) {
+            co_put_to_shres(task->s->mem, task->req.bytes);
+        }
         block_copy_task_end(task, -ECANCELED);
         g_free(task);
         return -ECANCELED;
@@ -485,6 +543,39 @@ static coroutine_fn int block_copy_task_run(AioTaskPool *pool,
     return 0;
 }
 
+/*
+ * block_copy_do_bounce_copy
+ *
+ * Copy @nbytes at @offset by reading them into a bounce buffer and writing
+ * them back to the target.  Returns 0 on success.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+block_copy_do_bounce_copy(BlockCopyState *s, int64_t offset, int64_t nbytes,
+                          bool *error_is_read)
+{
+    int ret;
+    void *bounce_buffer = qemu_blockalign(s->source->bs, nbytes);
+
+    ret = bdrv_co_pread(s->source, offset, nbytes, bounce_buffer, 0);
+    if (ret < 0) {
+        trace_block_copy_read_fail(s, offset, ret);
+        *error_is_read = true;
+        goto out;
+    }
+
+    ret = bdrv_co_pwrite(s->target, offset, nbytes, bounce_buffer,
+                         s->write_flags);
+    if (ret < 0) {
+        trace_block_copy_write_fail(s, offset, ret);
+        *error_is_read = false;
+        goto out;
+    }
+
+out:
+    qemu_vfree(bounce_buffer);
+    return ret;
+}
+
 /*
  * block_copy_do_copy
  *
@@ -494,8 +585,10 @@ static coroutine_fn int block_copy_task_run(AioTaskPool *pool,
  * No sync here: neither bitmap nor intersecting requests handling, only copy.
  *
  * @method is an in-out argument, so that copy_range can be either extended to
- * a full-size buffer or disabled if the copy_range attempt fails.  The output
- * value of @method should be used for subsequent tasks.
+ * a full-size buffer or reported as failed, in which case the region is copied
+ * through a bounce buffer and @method is set to COPY_READ_WRITE.  The caller
+ * decides whether the output value of @method should be used for subsequent
+ * tasks.
  * Returns 0 on success.
  */
 static int coroutine_fn GRAPH_RDLOCK
@@ -504,7 +597,6 @@ block_copy_do_copy(BlockCopyState *s, int64_t offset, int64_t bytes,
 {
     int ret;
     int64_t nbytes = MIN(offset + bytes, s->len) - offset;
-    void *bounce_buffer = NULL;
 
     assert(offset >= 0 && bytes > 0 && INT64_MAX - offset >= bytes);
     assert(QEMU_IS_ALIGNED(offset, s->cluster_size));
@@ -536,46 +628,25 @@ block_copy_do_copy(BlockCopyState *s, int64_t offset, int64_t bytes,
 
         trace_block_copy_copy_range_fail(s, offset, ret);
         *method = COPY_READ_WRITE;
-        /* Fall through to read+write with allocated buffer */
 
-    case COPY_READ_WRITE_CLUSTER:
-    case COPY_READ_WRITE:
         /*
-         * In case of failed copy_range request above, we may proceed with
-         * buffered request larger than BLOCK_COPY_MAX_BUFFER.
-         * Still, further requests will be properly limited, so don't care too
-         * much. Moreover the most likely case (copy_range is unsupported for
-         * the configuration, so the very first copy_range request fails)
-         * is handled by setting large copy_size only after first successful
-         * copy_range.
+         * Offloaded tasks do not reserve buffer memory, so do it now that
+         * this region has to be copied with a bounce buffer.  The buffer may
+         * be larger than BLOCK_COPY_MAX_BUFFER, but it is still accounted
+         * for in s->mem.
          */
+        co_get_from_shres(s->mem, nbytes);
+        ret = block_copy_do_bounce_copy(s, offset, nbytes, error_is_read);
+        co_put_to_shres(s->mem, nbytes);
+        return ret;
 
-        bounce_buffer = qemu_blockalign(s->source->bs, nbytes);
-
-        ret = bdrv_co_pread(s->source, offset, nbytes, bounce_buffer, 0);
-        if (ret < 0) {
-            trace_block_copy_read_fail(s, offset, ret);
-            *error_is_read = true;
-            goto out;
-        }
-
-        ret = bdrv_co_pwrite(s->target, offset, nbytes, bounce_buffer,
-                             s->write_flags);
-        if (ret < 0) {
-            trace_block_copy_write_fail(s, offset, ret);
-            *error_is_read = false;
-            goto out;
-        }
-
-    out:
-        qemu_vfree(bounce_buffer);
-        break;
+    case COPY_READ_WRITE_CLUSTER:
+    case COPY_READ_WRITE:
+        return block_copy_do_bounce_copy(s, offset, nbytes, error_is_read);
 
     default:
         abort();
     }
-
-    return ret;
 }
 
 static coroutine_fn int block_copy_task_entry(AioTask *task)
@@ -584,15 +655,37 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
     BlockCopyState *s = t->s;
     bool error_is_read = false;
     BlockCopyMethod method = t->method;
+    BlockCopyPool pool = block_copy_method_pool(t->method);
+    int64_t start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     int ret = -1;
 
+    if (task->pool) {
+        t->call_state->workers[pool]++;
+    }
+
     WITH_GRAPH_RDLOCK_GUARD() {
         ret = block_copy_do_copy(s, t->req.offset, t->req.bytes, &method,
                                  &error_is_read);
     }
 
+    block_copy_account_latency(s, pool,
+                               qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                               start_ns);
+
     WITH_QEMU_LOCK_GUARD(&s->lock) {
-        if (s->method == t->method) {
+        if (method == COPY_RANGE_FULL) {
+            s->copy_range_failures = 0;
+        } else if (method != t->method) {
+            s->copy_range_failures++;
+        }
+
+        /*
+         * Switch to the new method only if nobody changed it in the meantime,
+         * and give up on copy_range only after repeated failures.
+         */
+        if (s->method == t->method && method != t->method &&
+            (method == COPY_RANGE_FULL ||
+             s->copy_range_failures >= BLOCK_COPY_MAX_COPY_RANGE_FAILURES)) {
             s->method = method;
         }
 
@@ -605,7 +698,9 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
             progress_work_done(s->progress, t->req.bytes);
         }
     }
-    co_put_to_shres(s->mem, t->req.bytes);
+    if (pool == BLOCK_COPY_POOL_BOUNCE) {
+        co_put_to_shres(s->mem, t->req.bytes);
+    }
     block_copy_task_end(t, ret);
 
     if (s->discard_source && ret == 0) {
@@ -616,6 +711,9 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
         }
     }
 
+    if (task->pool) {
+        t->call_state->workers[pool]--;
+    }
     return ret;
 }
 
@@ -736,6 +834,37 @@ int64_t coroutine_fn block_copy_reset_unallocated(BlockCopyState *s,
     return ret;
 }
 
+/*
+ * Wait until fewer than max_workers tasks of @call_state are running, so
+ * that the pools share the limit instead of each getting the whole of it.
+ * Whichever kind of copy is in use can take all the workers.
+ */
+static void coroutine_fn block_copy_wait_worker(BlockCopyCallState *call_state,
+                                                AioTaskPool **aio)
+{
+    while (call_state->workers[BLOCK_COPY_POOL_OFFLOAD] +
+           call_state->workers[BLOCK_COPY_POOL_BOUNCE] >=
+           call_state->max_workers) {
+        aio_task_pool_wait_one(call_state->workers[BLOCK_COPY_POOL_OFFLOAD] ?
+                               aio[BLOCK_COPY_POOL_OFFLOAD] :
+                               aio[BLOCK_COPY_POOL_BOUNCE]);
+    }
+}
+
+/* Return the first error status among the task pools, or 0 */
+static int block_copy_pools_status(AioTaskPool **aio)
+{
+    int i, ret;
+
+    for (i = 0; i < BLOCK_COPY_POOL__MAX; i++) {
+        ret = aio_task_pool_status(aio[i]);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
 /*
  * block_copy_dirty_clusters
  *
@@ -753,7 +882,8 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
     int ret = 0;
     bool found_dirty = false;
     int64_t end = offset + bytes;
-    AioTaskPool *aio = NULL;
+    AioTaskPool *aio[BLOCK_COPY_POOL__MAX] = { NULL };
+    BlockCopyPool pool;
 
     /*
      * block_copy() user is responsible for keeping source and target in same
@@ -765,7 +895,7 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
     assert(QEMU_IS_ALIGNED(offset, s->cluster_size));
     assert(QEMU_IS_ALIGNED(bytes, s->cluster_size));
 
-    while (bytes && aio_task_pool_status(aio) == 0 &&
+    while (bytes && block_copy_pools_status(aio) == 0 &&
            !qatomic_read(&call_state->cancelled)) {
         BlockCopyTask *task;
         int64_t status_bytes;
@@ -816,24 +946,40 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
 
         trace_block_copy_process(s, task->req.offset);
 
-        co_get_from_shres(s->mem, task->req.bytes);
+        pool = block_copy_method_pool(task->method);
+        if (pool == BLOCK_COPY_POOL_BOUNCE) {
+            co_get_from_shres(s->mem, task->req.bytes);
+        }
 
         offset = task_end(task);
         bytes = end - offset;
 
-        if (!aio && bytes) {
-            aio = aio_task_pool_new(call_state->max_workers);
+        /*
+         * The last task runs synchronously only if no pool was needed so
+         * far; otherwise its failure would not be seen by
+         * block_copy_pools_status().
+         */
+        if (!aio[pool] && (bytes || aio[BLOCK_COPY_POOL_OFFLOAD] ||
+                           aio[BLOCK_COPY_POOL_BOUNCE])) {
+            aio[pool] = aio_task_pool_new(call_state->max_workers);
+        }
+        if (aio[pool]) {
+            block_copy_wait_worker(call_state, aio);
         }
 
-        ret = block_copy_task_run(aio, task);
+        ret = block_copy_task_run(aio[pool], task);
         if (ret < 0) {
             goto out;
         }
     }
 
 out:
-    if (aio) {
-        aio_task_pool_wait_all(aio);
+    if (aio[BLOCK_COPY_POOL_OFFLOAD] || aio[BLOCK_COPY_POOL_BOUNCE]) {
+        for (pool = 0; pool < BLOCK_COPY_POOL__MAX; pool++) {
+            if (aio[pool]) {
+                aio_task_pool_wait_all(aio[pool]);
+            }
+        }
 
         /*
          * We are not really interested in -ECANCELED returned from
@@ -843,10 +989,12 @@ out:
          *
          * Note: ret may be positive here because of block-status result.
          */
-        assert(ret >= 0 || aio_task_pool_status(aio) < 0);
-        ret = aio_task_pool_status(aio);
+        assert(ret >= 0 || block_copy_pools_status(aio) < 0);
+        ret = block_copy_pools_status(aio);
 
-        aio_task_pool_free(aio);
+        for (pool = 0; pool < BLOCK_COPY_POOL__MAX; pool++) {
+            aio_task_pool_free(aio[pool]);
+        }
     }
 
     return ret < 0 ? ret : found_dirty;
@@ -1057,6 +1205,36 @@ int64_t block_copy_cluster_size(BlockCopyState *s)
     return s->cluster_size;
 }
 
+static BlockLatencyHistogramInfo *
+block_copy_latency_histogram_info(BlockCopyState *s, BlockCopyPool pool)
+{
+    BlockLatencyHistogramInfo *info = g_new0(BlockLatencyHistogramInfo, 1);
+    uint64List **boundaries_tail = &info->boundaries;
+    uint64List **bins_tail = &info->bins;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(block_copy_latency_boundaries); i++) {
+        QAPI_LIST_APPEND(boundaries_tail, block_copy_latency_boundaries[i]);
+    }
+    for (i = 0; i < BLOCK_COPY_LATENCY_BINS; i++) {
+        QAPI_LIST_APPEND(bins_tail, stat64_get(&s->latency[pool][i]));
+    }
+
+    return info;
+}
+
+BlockLatencyHistogramInfo *
+block_copy_offload_latency_histogram(BlockCopyState *s)
+{
+    return block_copy_latency_histogram_info(s, BLOCK_COPY_POOL_OFFLOAD);
+}
+
+BlockLatencyHistogramInfo *
+block_copy_bounce_latency_histogram(BlockCopyState *s)
+{
+    return block_copy_latency_histogram_info(s, BLOCK_COPY_POOL_BOUNCE);
+}
+
 void block_copy_set_skip_unallocated(BlockCopyState *s, bool skip)
 {
     qatomic_set(&s->skip_unallocated, skip);
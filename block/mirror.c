@@ -29,6 +29,12 @@
 #define MAX_IO_BYTES (1 << 20) /* 1 Mb */
 #define DEFAULT_MIRROR_BUF_SIZE (MAX_IN_FLIGHT * MAX_IO_BYTES)
 
+/* Limits and sampling parameters of the adaptive copy mode */
+#define MIRROR_ADAPTIVE_MIN_IN_FLIGHT 2
+#define MIRROR_ADAPTIVE_MAX_IN_FLIGHT 64
+#define MIRROR_ADAPTIVE_SAMPLE_NS (10 * BLOCK_JOB_SLICE_TIME)
+#define MIRROR_ADAPTIVE_STALL_SAMPLES 5
+
 /* The mirroring buffer is a list of granularity-sized chunks.
  * Free chunks are organized in a list.
  */
@@ -60,6 +66,14 @@ typedef struct MirrorBlockJob {
      * current implementation of mirror_change()).
      */
     MirrorCopyMode copy_mode;
+    /*
+     * To be accessed with atomics.
+     *
+     * Set by the job itself when running in adaptive mode and the background
+     * copy could not keep up with the guest; from then on, guest writes are
+     * copied synchronously like in write-blocking mode.
+     */
+    bool adaptive_write_blocking;
     BlockdevOnError on_source_error, on_target_error;
     /*
      * To be accessed with atomics.
@@ -84,6 +98,18 @@ typedef struct MirrorBlockJob {
     unsigned in_flight;
     int64_t bytes_in_flight;
     QTAILQ_HEAD(, MirrorOp) ops_in_flight;
+    /* Current limits for background copy requests */
+    unsigned max_in_flight;
+    int64_t max_io_bytes;
+    /* Bytes copied by background requests, used for the adaptive mode */
+    uint64_t bytes_copied;
+    /* State of the adaptive mode controller, see mirror_adapt() */
+    int64_t adapt_sample_ns;
+    int64_t adapt_sample_remaining;
+    uint64_t adapt_sample_copied;
+    uint64_t adapt_last_copy_rate;
+    int adapt_direction;
+    int adapt_stalled_samples;
     int ret;
     bool unmap;
     int target_cluster_size;
@@ -223,6 +249,7 @@ static void coroutine_fn mirror_iteration_done(MirrorOp *op, int ret)
         }
         if (!s->initial_zeroing_ongoing) {
             job_progress_update(&s->common.job, op->bytes);
+            s->bytes_copied += op->bytes;
         }
     }
     qemu_iovec_destroy(&op->qiov);
@@ -488,7 +515,7 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
     /* At least the first dirty chunk is mirrored in one iteration. */
     int nb_chunks = 1;
     bool write_zeroes_ok = bdrv_can_write_zeroes_with_unmap(blk_bs(s->target));
-    int max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+    int64_t max_io_bytes = s->max_io_bytes;
 
     bdrv_graph_co_rdlock();
     source = s->mirror_top_bs->backing->bs;
@@ -600,7 +627,7 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
             }
         }
 
-        while (s->in_flight >= MAX_IN_FLIGHT) {
+        while (s->in_flight >= s->max_in_flight) {
             trace_mirror_yield_in_flight(s, offset, s->in_flight);
             mirror_wait_for_free_in_flight_slot(s);
         }
@@ -866,7 +893,7 @@ static int coroutine_fn GRAPH_UNLOCKED mirror_dirty_init(MirrorBlockJob *s)
                 return 0;
             }
 
-            if (s->in_flight >= MAX_IN_FLIGHT) {
+            if (s->in_flight >= s->max_in_flight) {
                 trace_mirror_yield(s, UINT64_MAX, s->buf_free_count,
                                    s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -910,6 +937,97 @@ static int coroutine_fn GRAPH_UNLOCKED mirror_dirty_init(MirrorBlockJob *s)
     return 0;
 }
 
+/*
+ * Whether guest writes are currently copied synchronously to the target,
+ * either because the user asked for it or because the adaptive mode
+ * switched over.
+ */
+static bool mirror_is_write_blocking(MirrorBlockJob *s)
+{
+    switch (qatomic_read(&s->copy_mode)) {
+    case MIRROR_COPY_MODE_WRITE_BLOCKING:
+        return true;
+    case MIRROR_COPY_MODE_ADAPTIVE:
+        return qatomic_read(&s->adaptive_write_blocking);
+    default:
+        return false;
+    }
+}
+
+/*
+ * Adaptive copy mode controller, called once per iteration of the main loop
+ * with @cnt being the current dirty count.
+ *
+ * Every MIRROR_ADAPTIVE_SAMPLE_NS, compare the rate at which the guest dirties
+ * the source with the rate at which background requests copy it.  As long as
+ * the job does not converge, hill-climb on the number of requests in flight:
+ * keep moving in the same direction while the copy rate improves, otherwise
+ * turn around.  The request size shrinks as the window grows so that the
+ * whole window still fits in the mirror buffer.  If the copy rate stays below
+ * the dirty rate for MIRROR_ADAPTIVE_STALL_SAMPLES samples in a row, give up
+ * on background copying and copy guest writes synchronously.
+ */
+static void mirror_adapt(MirrorBlockJob *s, int64_t cnt)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t elapsed = now - s->adapt_sample_ns;
+    int64_t remaining = cnt + s->bytes_in_flight;
+    uint64_t copied, dirtied, copy_rate, dirty_rate;
+    unsigned max_in_flight;
+
+    if (elapsed < MIRROR_ADAPTIVE_SAMPLE_NS ||
+        qatomic_read(&s->adaptive_write_blocking)) {
+        return;
+    }
+
+    /*
+     * Whatever was copied and did not make the remaining amount of work
+     * shrink accordingly has been dirtied again by the guest.
+     */
+    copied = s->bytes_copied - s->adapt_sample_copied;
+    dirtied = MAX(remaining + (int64_t)copied - s->adapt_sample_remaining, 0);
+    copy_rate = copied * 1000 / MAX(elapsed / SCALE_MS, 1);
+    dirty_rate = dirtied * 1000 / MAX(elapsed / SCALE_MS, 1);
+
+    s->adapt_sample_ns = now;
+    s->adapt_sample_remaining = remaining;
+    s->adapt_sample_copied = s->bytes_copied;
+
+    if (remaining == 0 || dirty_rate < copy_rate) {
+        s->adapt_stalled_samples = 0;
+        s->adapt_last_copy_rate = copy_rate;
+        trace_mirror_adapt(s, copy_rate, dirty_rate, s->max_in_flight,
+                           s->max_io_bytes);
+        return;
+    }
+
+    if (++s->adapt_stalled_samples >= MIRROR_ADAPTIVE_STALL_SAMPLES) {
+        trace_mirror_adaptive_write_blocking(s, copy_rate, dirty_rate);
+        qatomic_set(&s->adaptive_write_blocking, true);
+        return;
+    }
+
+    if (copy_rate < s->adapt_last_copy_rate) {
+        s->adapt_direction = -s->adapt_direction;
+    }
+    s->adapt_last_copy_rate = copy_rate;
+
+    if (s->adapt_direction > 0) {
+        max_in_flight = MIN(s->max_in_flight * 2,
+                            MIRROR_ADAPTIVE_MAX_IN_FLIGHT);
+    } else {
+        max_in_flight = MAX(s->max_in_flight / 2,
+                            MIRROR_ADAPTIVE_MIN_IN_FLIGHT);
+    }
+    s->max_in_flight = max_in_flight;
+    s->max_io_bytes = MAX(QEMU_ALIGN_DOWN(s->buf_size / max_in_flight,
+                                          s->granularity),
+                          s->granularity);
+
+    trace_mirror_adapt(s, copy_rate, dirty_rate, s->max_in_flight,
+                       s->max_io_bytes);
+}
+
 /* Called when going out of the streaming phase to flush the bulk of the
  * data to the medium, or just before completing.
  */
@@ -1018,6 +1136,8 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
     }
 
     mirror_free_init(s);
+    s->max_in_flight = MAX_IN_FLIGHT;
+    s->max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
 
     s->last_pause_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     if (!s->is_none_mode) {
@@ -1035,6 +1155,9 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
 
     assert(!s->dbi);
     s->dbi = bdrv_dirty_iter_new(s->dirty_bitmap);
+    s->adapt_sample_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    s->adapt_sample_remaining = bdrv_get_dirty_count(s->dirty_bitmap);
+    s->adapt_direction = 1;
     for (;;) {
         int64_t cnt, delta;
         bool should_complete;
@@ -1059,6 +1182,10 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
                                    s->bytes_in_flight + cnt +
                                    s->active_write_bytes_in_flight);
 
+        if (qatomic_read(&s->copy_mode) == MIRROR_COPY_MODE_ADAPTIVE) {
+            mirror_adapt(s, cnt);
+        }
+
         /* Note that even when no rate limit is applied we need to yield
          * periodically with no pending I/O so that bdrv_drain_all() returns.
          * We do so every BLKOCK_JOB_SLICE_TIME nanoseconds, or when there is
@@ -1069,7 +1196,7 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
         }
         if (delta < BLOCK_JOB_SLICE_TIME &&
             iostatus == BLOCK_DEVICE_IO_STATUS_OK) {
-            if (s->in_flight >= MAX_IN_FLIGHT || s->buf_free_count == 0 ||
+            if (s->in_flight >= s->max_in_flight || s->buf_free_count == 0 ||
                 (cnt == 0 && s->in_flight > 0)) {
                 trace_mirror_yield(s, cnt, s->buf_free_count, s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -1094,7 +1221,7 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
                  */
                 job_transition_to_ready(&s->common.job);
             }
-            if (qatomic_read(&s->copy_mode) != MIRROR_COPY_MODE_BACKGROUND) {
+            if (mirror_is_write_blocking(s)) {
                 qatomic_set(&s->actively_synced, true);
             }
 
@@ -1263,7 +1390,7 @@ static void mirror_change(BlockJob *job, BlockJobChangeOptions *opts,
 {
     MirrorBlockJob *s = container_of(job, MirrorBlockJob, common);
     BlockJobChangeOptionsMirror *change_opts = &opts->u.mirror;
-    MirrorCopyMode current;
+    MirrorCopyMode current, expected;
 
     /*
      * The implementation relies on the fact that copy_mode is only written
@@ -1282,11 +1409,13 @@ static void mirror_change(BlockJob *job, BlockJobChangeOptions *opts,
         return;
     }
 
-    current = qatomic_cmpxchg(&s->copy_mode, MIRROR_COPY_MODE_BACKGROUND,
+    expected = qatomic_read(&s->copy_mode) == MIRROR_COPY_MODE_ADAPTIVE ?
+               MIRROR_COPY_MODE_ADAPTIVE : MIRROR_COPY_MODE_BACKGROUND;
+    current = qatomic_cmpxchg(&s->copy_mode, expected,
                               change_opts->copy_mode);
-    if (current != MIRROR_COPY_MODE_BACKGROUND) {
+    if (current != expected) {
         error_setg(errp, "Expected current copy mode '%s', got '%s'",
-                   MirrorCopyMode_str(MIRROR_COPY_MODE_BACKGROUND),
+                   MirrorCopyMode_str(expected),
                    MirrorCopyMode_str(current));
     }
 }
@@ -1297,6 +1426,7 @@ static void mirror_query(BlockJob *job, BlockJobInfo *info)
 
     info->u.mirror = (BlockJobInfoMirror) {
         .actively_synced = qatomic_read(&s->actively_synced),
+        .copy_mode = qatomic_read(&s->copy_mode),
     };
 }
 
@@ -1524,7 +1654,7 @@ static bool should_copy_to_target(MirrorBDSOpaque *s)
 {
     return s->job && s->job->ret >= 0 &&
         !job_is_cancelled(&s->job->common.job) &&
-        qatomic_read(&s->job->copy_mode) == MIRROR_COPY_MODE_WRITE_BLOCKING;
+        mirror_is_write_blocking(s->job);
 }
 
 static int coroutine_fn GRAPH_RDLOCK
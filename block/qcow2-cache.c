@@ -28,6 +28,9 @@
 #include "qcow2.h"
 #include "trace.h"
 
+/* Maximum number of adjacent tables that are written with one request */
+#define QCOW2_CACHE_MAX_WRITE_TABLES 64
+
 typedef struct Qcow2CachedTable {
     int64_t  offset;
     uint64_t lru_counter;
@@ -179,16 +182,16 @@ qcow2_cache_flush_dependency(BlockDriverState *bs, Qcow2Cache *c)
     return 0;
 }
 
+/*
+ * Prepare writing back dirty entry @i: flush the cache it depends on and do
+ * the overlap checks.
+ */
 static int GRAPH_RDLOCK
-qcow2_cache_entry_flush(BlockDriverState *bs, Qcow2Cache *c, int i)
+qcow2_cache_entry_prepare_flush(BlockDriverState *bs, Qcow2Cache *c, int i)
 {
     BDRVQcow2State *s = bs->opaque;
     int ret = 0;
 
-    if (!c->entries[i].dirty || !c->entries[i].offset) {
-        return 0;
-    }
-
     trace_qcow2_cache_entry_flush(qemu_coroutine_self(),
                                   c == s->l2_table_cache, i);
 
@@ -226,6 +229,23 @@ qcow2_cache_entry_flush(BlockDriverState *bs, Qcow2Cache *c, int i)
         BLKDBG_EVENT(bs->file, BLKDBG_L2_UPDATE);
     }
 
+    return 0;
+}
+
+static int GRAPH_RDLOCK
+qcow2_cache_entry_flush(BlockDriverState *bs, Qcow2Cache *c, int i)
+{
+    int ret;
+
+    if (!c->entries[i].dirty || !c->entries[i].offset) {
+        return 0;
+    }
+
+    ret = qcow2_cache_entry_prepare_flush(bs, c, i);
+    if (ret < 0) {
+        return ret;
+    }
+
     ret = bdrv_pwrite(bs->file, c->entries[i].offset, c->table_size,
                       qcow2_cache_get_table_addr(c, i), 0);
     if (ret < 0) {
@@ -237,17 +257,88 @@ qcow2_cache_entry_flush(BlockDriverState *bs, Qcow2Cache *c, int i)
     return 0;
 }
 
+/*
+ * Write back the @n dirty entries listed in @idx, which describe adjacent
+ * tables in the image file in ascending order, with a single request.
+ */
+static int GRAPH_RDLOCK
+qcow2_cache_write_run(BlockDriverState *bs, Qcow2Cache *c, const int *idx,
+                      int n)
+{
+    QEMUIOVector qiov;
+    int ret = 0;
+    int i;
+
+    qemu_iovec_init(&qiov, n);
+    for (i = 0; i < n; i++) {
+        ret = qcow2_cache_entry_prepare_flush(bs, c, idx[i]);
+        if (ret < 0) {
+            goto out;
+        }
+        qemu_iovec_add(&qiov, qcow2_cache_get_table_addr(c, idx[i]),
+                       c->table_size);
+    }
+
+    ret = bdrv_pwritev(bs->file, c->entries[idx[0]].offset, qiov.size, &qiov,
+                       0);
+    if (ret < 0) {
+        goto out;
+    }
+
+    for (i = 0; i < n; i++) {
+        c->entries[idx[i]].dirty = false;
+    }
+
+out:
+    qemu_iovec_destroy(&qiov);
+    return ret;
+}
+
+static int qcow2_cache_compare_offset(const void *a, const void *b,
+                                      void *opaque)
+{
+    Qcow2Cache *c = opaque;
+    int64_t offset_a = c->entries[*(const int *)a].offset;
+    int64_t offset_b = c->entries[*(const int *)b].offset;
+
+    return offset_a < offset_b ? -1 : offset_a > offset_b;
+}
+
+/*
+ * Write back all dirty entries.  They are written in ascending offset order,
+ * and tables that are adjacent in the image file are merged into a single
+ * request, so that a flush results in few mostly sequential writes rather
+ * than in one small write per table.
+ */
 int qcow2_cache_write(BlockDriverState *bs, Qcow2Cache *c)
 {
     BDRVQcow2State *s = bs->opaque;
+    g_autofree int *dirty = g_new(int, c->size);
+    int nb_dirty = 0;
     int result = 0;
     int ret;
-    int i;
+    int i, n;
 
     trace_qcow2_cache_flush(qemu_coroutine_self(), c == s->l2_table_cache);
 
     for (i = 0; i < c->size; i++) {
-        ret = qcow2_cache_entry_flush(bs, c, i);
+        if (c->entries[i].dirty && c->entries[i].offset) {
+            dirty[nb_dirty++] = i;
+        }
+    }
+
+    g_qsort_with_data(dirty, nb_dirty, sizeof(dirty[0]),
+                      qcow2_cache_compare_offset, c);
+
+    for (i = 0; i < nb_dirty; i += n) {
+        for (n = 1; i + n < nb_dirty && n < QCOW2_CACHE_MAX_WRITE_TABLES; n++) {
+            if (c->entries[dirty[i + n]].offset !=
+                c->entries[dirty[i + n - 1]].offset + c->table_size) {
+                break;
+            }
+        }
+
+        ret = qcow2_cache_write_run(bs, c, &dirty[i], n);
         if (ret < 0 && result != -ENOSPC) {
             result = ret;
         }
@@ -964,13 +964,97 @@ int qcow2_update_cluster_refcount(BlockDriverState *bs,
 
 
 
+/*
+ * Returns the number of consecutive free clusters starting at @cluster_index,
+ * looking at no more than @nb_clusters clusters.  Each refcount block is only
+ * looked up once in the cache, instead of once per cluster, which keeps the
+ * time spent under s->lock short when allocating or skipping many clusters.
+ *
+ * If fewer than @nb_clusters clusters are free, *@nb_used is set to the
+ * number of used clusters that follow them in the same refcount block, so
+ * that the caller can skip the whole run without looking it up again.
+ *
+ * Returns -errno on error.
+ */
+static int64_t GRAPH_RDLOCK
+count_free_clusters(BlockDriverState *bs, uint64_t cluster_index,
+                    uint64_t nb_clusters, uint64_t *nb_used)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t i = 0, j, k;
+    int ret;
+
+    *nb_used = 0;
+
+    while (i < nb_clusters) {
+        uint64_t refcount_table_index =
+            (cluster_index + i) >> s->refcount_block_bits;
+        uint64_t block_index = (cluster_index + i) &
+                               (s->refcount_block_size - 1);
+        uint64_t n = MIN(nb_clusters - i,
+                         s->refcount_block_size - block_index);
+        int64_t refcount_block_offset;
+        void *refcount_block;
+
+        if (refcount_table_index >= s->refcount_table_size) {
+            /* Everything past the end of the refcount table is free */
+            return nb_clusters;
+        }
+
+        refcount_block_offset =
+            s->refcount_table[refcount_table_index] & REFT_OFFSET_MASK;
+        if (!refcount_block_offset) {
+            i += n;
+            continue;
+        }
+
+        if (offset_into_cluster(s, refcount_block_offset)) {
+            qcow2_signal_corruption(bs, true, -1, -1, "Refblock offset %#"
+                                    PRIx64 " unaligned (reftable index: %#"
+                                    PRIx64 ")", refcount_block_offset,
+                                    refcount_table_index);
+            return -EIO;
+        }
+
+        ret = qcow2_cache_get(bs, s->refcount_block_cache,
+                              refcount_block_offset, &refcount_block);
+        if (ret < 0) {
+            return ret;
+        }
+
+        for (j = 0; j < n; j++) {
+            if (s->get_refcount(refcount_block, block_index + j) != 0) {
+                break;
+            }
+        }
+
+        if (j < n) {
+            for (k = block_index + j + 1; k < s->refcount_block_size; k++) {
+                if (s->get_refcount(refcount_block, k) == 0) {
+                    break;
+                }
+            }
+            *nb_used = k - (block_index + j);
+        }
+
+        qcow2_cache_put(s->refcount_block_cache, &refcount_block);
+
+        i += j;
+        if (j < n) {
+            break;
+        }
+    }
+
+    return i;
+}
+
 /* return < 0 if error */
 static int64_t GRAPH_RDLOCK
 alloc_clusters_noref(BlockDriverState *bs, uint64_t size, uint64_t max)
 {
     BDRVQcow2State *s = bs->opaque;
-    uint64_t i, nb_clusters, refcount;
-    int ret;
+    uint64_t nb_clusters, nb_used;
+    int64_t nb_free;
 
     /* We can't allocate clusters if they may still be queued for discard. */
     if (s->cache_discards) {
@@ -978,16 +1062,20 @@ alloc_clusters_noref(BlockDriverState *bs, uint64_t size, uint64_t max)
     }
 
     nb_clusters = size_to_clusters(s, size);
-retry:
-    for(i = 0; i < nb_clusters; i++) {
-        uint64_t next_cluster_index = s->free_cluster_index++;
-        ret = qcow2_get_refcount(bs, next_cluster_index, &refcount);
+    for (;;) {
+        nb_free = count_free_clusters(bs, s->free_cluster_index, nb_clusters,
+                                      &nb_used);
+        if (nb_free < 0) {
+            return nb_free;
+        }
 
-        if (ret < 0) {
-            return ret;
-        } else if (refcount != 0) {
-            goto retry;
+        if (nb_free == nb_clusters) {
+            s->free_cluster_index += nb_clusters;
+            break;
         }
+
+        /* Skip the free clusters we found and the used ones after them */
+        s->free_cluster_index += nb_free + nb_used;
     }
 
     /* Make sure that all offsets in the "allocated" range are representable
@@ -1032,8 +1120,8 @@ int64_t coroutine_fn qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offs
                                              int64_t nb_clusters)
 {
     BDRVQcow2State *s = bs->opaque;
-    uint64_t cluster_index, refcount;
-    uint64_t i;
+    uint64_t nb_used;
+    int64_t nb_free;
     int ret;
 
     assert(nb_clusters >= 0);
@@ -1043,18 +1131,14 @@ int64_t coroutine_fn qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offs
 
     do {
         /* Check how many clusters there are free */
-        cluster_index = offset >> s->cluster_bits;
-        for(i = 0; i < nb_clusters; i++) {
-            ret = qcow2_get_refcount(bs, cluster_index++, &refcount);
-            if (ret < 0) {
-                return ret;
-            } else if (refcount != 0) {
-                break;
-            }
+        nb_free = count_free_clusters(bs, offset >> s->cluster_bits,
+                                      nb_clusters, &nb_used);
+        if (nb_free < 0) {
+            return nb_free;
         }
 
         /* And then allocate them */
-        ret = update_refcount(bs, offset, i << s->cluster_bits, 1, false,
+        ret = update_refcount(bs, offset, nb_free << s->cluster_bits, 1, false,
                               QCOW2_DISCARD_NEVER);
     } while (ret == -EAGAIN);
 
@@ -1062,7 +1146,7 @@ int64_t coroutine_fn qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offs
         return ret;
     }
 
-    return i;
+    return nb_free;
 }
 
 /* only used to allocate compressed sectors. We try to allocate
@@ -16,12 +16,17 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/bitops.h"
 #include "qemu/crc32c.h"
 #include "trace.h"
 #include "net_rx_pkt.h"
 #include "net/checksum.h"
 #include "net/tap.h"
 
+/* Toeplitz key size and longest hash input (IPv6 addresses and ports) */
+#define NET_RX_PKT_RSS_KEY_SIZE     40
+#define NET_RX_PKT_RSS_INPUT_SIZE   36
+
 struct NetRxPkt {
     struct virtio_net_hdr virt_hdr;
     struct {
@@ -47,6 +52,10 @@ struct NetRxPkt {
     eth_ip6_hdr_info ip6hdr_info;
     eth_ip4_hdr_info ip4hdr_info;
     eth_l4_hdr_info  l4hdr_info;
+
+    /* RSS hash lookup table for rss_key, see net_rx_pkt_rss_table_update() */
+    uint8_t rss_key[NET_RX_PKT_RSS_KEY_SIZE];
+    uint32_t (*rss_table)[256];
 };
 
 void net_rx_pkt_init(struct NetRxPkt **pkt)
@@ -63,6 +72,7 @@ void net_rx_pkt_uninit(struct NetRxPkt *pkt)
         g_free(pkt->vec);
     }
 
+    g_free(pkt->rss_table);
     g_free(pkt);
 }
 
@@ -300,15 +310,56 @@ _net_rx_rss_prepare_udp(uint8_t *rss_input,
                           &udphdr->uh_dport, sizeof(uint16_t));
 }
 
+/*
+ * The Toeplitz hash is linear in its input, so it can be computed as the
+ * XOR of the contributions of the individual input bytes.  Precompute the
+ * contribution of every byte value at every input position for @key, which
+ * turns the per-packet bit-by-bit loop into one lookup per input byte.
+ * The table is only rebuilt when the guest programs a different key.
+ */
+static void net_rx_pkt_rss_table_update(struct NetRxPkt *pkt,
+                                        const uint8_t *key)
+{
+    uint32_t bit_hash[BITS_PER_BYTE];
+    int i, bit, val;
+
+    if (pkt->rss_table && !memcmp(pkt->rss_key, key, sizeof(pkt->rss_key))) {
+        return;
+    }
+
+    if (!pkt->rss_table) {
+        pkt->rss_table = g_malloc(NET_RX_PKT_RSS_INPUT_SIZE *
+                                  sizeof(*pkt->rss_table));
+    }
+    memcpy(pkt->rss_key, key, sizeof(pkt->rss_key));
+
+    for (i = 0; i < NET_RX_PKT_RSS_INPUT_SIZE; i++) {
+        /* The 32-bit key windows for input byte i start at key bit 8 * i */
+        uint64_t window = ((uint64_t)ldl_be_p(key + i) << 32) |
+                          ((uint64_t)key[i + 4] << 24);
+
+        for (bit = 0; bit < BITS_PER_BYTE; bit++) {
+            bit_hash[bit] = window >> (32 - bit);
+        }
+
+        pkt->rss_table[i][0] = 0;
+        for (val = 1; val < 256; val++) {
+            /* Add the lowest set bit (the last one in input order) */
+            pkt->rss_table[i][val] = pkt->rss_table[i][val & (val - 1)] ^
+                                     bit_hash[7 - ctz32(val)];
+        }
+    }
+}
+
 uint32_t
 net_rx_pkt_calc_rss_hash(struct NetRxPkt *pkt,
                          NetRxPktRssType type,
                          uint8_t *key)
 {
-    uint8_t rss_input[36];
+    uint8_t rss_input[NET_RX_PKT_RSS_INPUT_SIZE];
     size_t rss_length = 0;
     uint32_t rss_hash = 0;
-    net_toeplitz_key key_data;
+    size_t i;
 
     switch (type) {
     case NetPktRssIpV4:
@@ -372,8 +423,10 @@ net_rx_pkt_calc_rss_hash(struct NetRxPkt *pkt,
         g_assert_not_reached();
     }
 
-    net_toeplitz_key_init(&key_data, key);
-    net_toeplitz_add(&rss_hash, rss_input, rss_length, &key_data);
+    net_rx_pkt_rss_table_update(pkt, key);
+    for (i = 0; i < rss_length; i++) {
+        rss_hash ^= pkt->rss_table[i][rss_input[i]];
+    }
 
     trace_net_rx_pkt_rss_hash(rss_length, rss_hash);
 
@@ -128,6 +128,7 @@ typedef enum {
 *
 * @pkt:            packet
 * @type:           RSS hash type
+* @key:            40-byte Toeplitz key
 *
 * Return:  Toeplitz RSS hash.
 *
@@ -59,6 +59,9 @@
 #define VIRTIO_NET_RX_QUEUE_MIN_SIZE VIRTIO_NET_RX_QUEUE_DEFAULT_SIZE
 #define VIRTIO_NET_TX_QUEUE_MIN_SIZE VIRTIO_NET_TX_QUEUE_DEFAULT_SIZE
 
+/* Maximum number of transmitted buffers returned to the guest at once */
+#define VIRTIO_NET_TX_COMPLETE_BATCH 64
+
 #define VIRTIO_NET_IP4_ADDR_SIZE   8        /* ipv4 saddr + daddr */
 
 #define VIRTIO_NET_TCP_FLAG         0x3F
@@ -189,6 +192,8 @@ static void virtio_net_get_config(VirtIODevice *vdev, uint8_t *config)
     }
 }
 
+static void virtio_net_update_backend_rx_filter(VirtIONet *n, bool enable);
+
 static void virtio_net_set_config(VirtIODevice *vdev, const uint8_t *config)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
@@ -202,6 +207,7 @@ static void virtio_net_set_config(VirtIODevice *vdev, const uint8_t *config)
         memcmp(netcfg.mac, n->mac, ETH_ALEN)) {
         memcpy(n->mac, netcfg.mac, ETH_ALEN);
         qemu_format_nic_info_str(qemu_get_queue(n->nic), n->mac);
+        virtio_net_update_backend_rx_filter(n, true);
     }
 
     /*
@@ -470,6 +476,59 @@ static void rxfilter_notify(NetClientState *nc)
     }
 }
 
+/*
+ * Mirror the guest's MAC filter into the backend (the tap device), so the
+ * host kernel drops unwanted unicast and multicast before they wake up QEMU.
+ * The backend only matches destination MACs and so lets through a superset
+ * of what receive_filter() accepts, which still runs for every packet.
+ */
+static void virtio_net_update_backend_rx_filter(VirtIONet *n, bool enable)
+{
+    static const uint8_t bcast[] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    g_autofree uint8_t *macs = NULL;
+    bool allmulti = false;
+    int count = 0;
+    int i;
+
+    if (!n->rx_filter_offload) {
+        return;
+    }
+
+    if (enable && !n->promisc && !n->alluni && !n->mac_table.uni_overflow) {
+        macs = g_malloc((MAC_TABLE_ENTRIES + 2) * ETH_ALEN);
+
+        /* The backend wants unicast addresses first */
+        if (!n->nouni) {
+            memcpy(&macs[count++ * ETH_ALEN], n->mac, ETH_ALEN);
+            for (i = 0; i < n->mac_table.first_multi; i++) {
+                memcpy(&macs[count++ * ETH_ALEN],
+                       &n->mac_table.macs[i * ETH_ALEN], ETH_ALEN);
+            }
+        }
+        if (!n->nobcast) {
+            memcpy(&macs[count++ * ETH_ALEN], bcast, ETH_ALEN);
+        }
+        if (n->nomulti) {
+            /* Only broadcast, added above */
+        } else if (n->allmulti || n->mac_table.multi_overflow) {
+            allmulti = true;
+        } else {
+            for (i = n->mac_table.first_multi; i < n->mac_table.in_use; i++) {
+                memcpy(&macs[count++ * ETH_ALEN],
+                       &n->mac_table.macs[i * ETH_ALEN], ETH_ALEN);
+            }
+        }
+    }
+
+    for (i = 0; i < n->max_queue_pairs; i++) {
+        NetClientState *peer = qemu_get_subqueue(n->nic, i)->peer;
+
+        if (peer && peer->info->set_rx_filter) {
+            peer->info->set_rx_filter(peer, macs, count, allmulti);
+        }
+    }
+}
+
 static intList *get_vlan_table(VirtIONet *n)
 {
     intList *list;
@@ -795,6 +854,9 @@ static uint64_t virtio_net_get_features(VirtIODevice *vdev, uint64_t features,
         return features;
     }
 
+    /* Coalescing is done by virtio_notify(), which vhost bypasses */
+    virtio_clear_feature(&features, VIRTIO_NET_F_NOTF_COAL);
+
     if (!ebpf_rss_is_loaded(&n->ebpf_rss)) {
         virtio_clear_feature(&features, VIRTIO_NET_F_RSS);
     }
@@ -1043,6 +1105,7 @@ static int virtio_net_handle_rx_mode(VirtIONet *n, uint8_t cmd,
         return VIRTIO_NET_ERR;
     }
 
+    virtio_net_update_backend_rx_filter(n, true);
     rxfilter_notify(nc);
 
     return VIRTIO_NET_OK;
@@ -1108,6 +1171,7 @@ static int virtio_net_handle_mac(VirtIONet *n, uint8_t cmd,
         s = iov_to_buf(iov, iov_cnt, 0, &n->mac, sizeof(n->mac));
         assert(s == sizeof(n->mac));
         qemu_format_nic_info_str(qemu_get_queue(n->nic), n->mac);
+        virtio_net_update_backend_rx_filter(n, true);
         rxfilter_notify(nc);
 
         return VIRTIO_NET_OK;
@@ -1180,6 +1244,7 @@ static int virtio_net_handle_mac(VirtIONet *n, uint8_t cmd,
     n->mac_table.multi_overflow = multi_overflow;
     memcpy(n->mac_table.macs, macs, MAC_TABLE_ENTRIES * ETH_ALEN);
     g_free(macs);
+    virtio_net_update_backend_rx_filter(n, true);
     rxfilter_notify(nc);
 
     return VIRTIO_NET_OK;
@@ -1540,6 +1605,56 @@ static int virtio_net_handle_mq(VirtIONet *n, uint8_t cmd,
     return VIRTIO_NET_OK;
 }
 
+static void virtio_net_apply_notf_coal(VirtIONet *n)
+{
+    int queue_pairs = n->multiqueue ? n->max_queue_pairs : 1;
+    int i;
+
+    for (i = 0; i < queue_pairs; i++) {
+        virtio_queue_set_notification_coalescing(n->vqs[i].rx_vq,
+                                                 n->rx_coal.max_packets,
+                                                 n->rx_coal.max_usecs,
+                                                 false);
+        virtio_queue_set_notification_coalescing(n->vqs[i].tx_vq,
+                                                 n->tx_coal.max_packets,
+                                                 n->tx_coal.max_usecs,
+                                                 false);
+    }
+}
+
+static int virtio_net_handle_notf_coal(VirtIONet *n, uint8_t cmd,
+                                       struct iovec *iov, unsigned int iov_cnt)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    struct virtio_net_ctrl_coal coal;
+    size_t s;
+
+    if (!virtio_vdev_has_feature(vdev, VIRTIO_NET_F_NOTF_COAL)) {
+        return VIRTIO_NET_ERR;
+    }
+
+    /* Both commands carry max_packets/max_usecs, in that order */
+    s = iov_to_buf(iov, iov_cnt, 0, &coal, sizeof(coal));
+    if (s != sizeof(coal)) {
+        return VIRTIO_NET_ERR;
+    }
+    coal.max_packets = virtio_ldl_p(vdev, &coal.max_packets);
+    coal.max_usecs = virtio_ldl_p(vdev, &coal.max_usecs);
+
+    if (cmd == VIRTIO_NET_CTRL_NOTF_COAL_TX_SET) {
+        n->tx_coal = coal;
+    } else if (cmd == VIRTIO_NET_CTRL_NOTF_COAL_RX_SET) {
+        n->rx_coal = coal;
+    } else {
+        return VIRTIO_NET_ERR;
+    }
+
+    trace_virtio_net_handle_notf_coal(cmd, coal.max_packets, coal.max_usecs);
+    virtio_net_apply_notf_coal(n);
+
+    return VIRTIO_NET_OK;
+}
+
 size_t virtio_net_handle_ctrl_iov(VirtIODevice *vdev,
                                   const struct iovec *in_sg, unsigned in_num,
                                   const struct iovec *out_sg,
@@ -1574,6 +1689,8 @@ size_t virtio_net_handle_ctrl_iov(VirtIODevice *vdev,
         status = virtio_net_handle_mq(n, ctrl.cmd, iov, out_num);
     } else if (ctrl.class == VIRTIO_NET_CTRL_GUEST_OFFLOADS) {
         status = virtio_net_handle_offloads(n, ctrl.cmd, iov, out_num);
+    } else if (ctrl.class == VIRTIO_NET_CTRL_NOTF_COAL) {
+        status = virtio_net_handle_notf_coal(n, ctrl.cmd, iov, out_num);
     }
 
     s = iov_from_buf(in_sg, in_num, 0, &status, sizeof(status));
@@ -2023,7 +2140,8 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     }
 
     virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
+    /* Backends may deliver a burst of packets, interrupt once for all */
+    virtio_notify_deferred(vdev, q->rx_vq);
 
     return size;
 
@@ -2682,12 +2800,38 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
     }
 }
 
+/*
+ * Return sent buffers to the guest with a single used index update and
+ * notification for the whole batch.
+ */
+static void virtio_net_tx_push_batch(VirtIONetQueue *q,
+                                     VirtQueueElement **elems,
+                                     unsigned int *num_elems)
+{
+    static const unsigned int lens[VIRTIO_NET_TX_COMPLETE_BATCH];
+    unsigned int i;
+
+    if (!*num_elems) {
+        return;
+    }
+
+    virtqueue_push_batch(q->tx_vq, elems, lens, *num_elems);
+    virtio_notify(VIRTIO_DEVICE(q->n), q->tx_vq);
+
+    for (i = 0; i < *num_elems; i++) {
+        g_free(elems[i]);
+    }
+    *num_elems = 0;
+}
+
 /* TX */
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     VirtQueueElement *elem;
+    VirtQueueElement *done[VIRTIO_NET_TX_COMPLETE_BATCH];
+    unsigned int num_done = 0;
     int32_t num_packets = 0;
     int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
@@ -2763,23 +2907,27 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
                                       out_sg, out_num, virtio_net_tx_complete);
         if (ret == 0) {
+            virtio_net_tx_push_batch(q, done, &num_done);
             virtio_queue_set_notification(q->tx_vq, 0);
             q->async_tx.elem = elem;
             return -EBUSY;
         }
 
 drop:
-        virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
-        g_free(elem);
+        done[num_done++] = elem;
+        if (num_done == ARRAY_SIZE(done)) {
+            virtio_net_tx_push_batch(q, done, &num_done);
+        }
 
         if (++num_packets >= n->tx_burst) {
             break;
         }
     }
+    virtio_net_tx_push_batch(q, done, &num_done);
     return num_packets;
 
 detach:
+    virtio_net_tx_push_batch(q, done, &num_done);
     virtqueue_detach_element(q->tx_vq, elem, 0);
     g_free(elem);
     return -EINVAL;
@@ -3032,6 +3180,14 @@ static void virtio_net_set_multiqueue(VirtIONet *n, int multiqueue)
     virtio_net_set_queue_pairs(n);
 }
 
+static bool virtio_net_notf_coal_needed(void *opaque)
+{
+    VirtIONet *n = VIRTIO_NET(opaque);
+
+    return n->rx_coal.max_packets || n->rx_coal.max_usecs ||
+           n->tx_coal.max_packets || n->tx_coal.max_usecs;
+}
+
 static int virtio_net_post_load_device(void *opaque, int version_id)
 {
     VirtIONet *n = opaque;
@@ -3071,6 +3227,7 @@ static int virtio_net_post_load_device(void *opaque, int version_id)
         }
     }
     n->mac_table.first_multi = i;
+    virtio_net_update_backend_rx_filter(n, true);
 
     /* nc.link_down can't be migrated, so infer link_down according
      * to link status bit in n->status */
@@ -3109,6 +3266,11 @@ static int virtio_net_post_load_virtio(VirtIODevice *vdev)
         virtio_net_apply_guest_offloads(n);
     }
 
+    /* Like the offloads, this must wait for the queues to be recreated */
+    if (virtio_net_notf_coal_needed(n)) {
+        virtio_net_apply_notf_coal(n);
+    }
+
     return 0;
 }
 
@@ -3296,6 +3458,20 @@ static const VMStateDescription vmstate_virtio_net_rss = {
     },
 };
 
+static const VMStateDescription vmstate_virtio_net_notf_coal = {
+    .name      = "virtio-net-device/notf_coal",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = virtio_net_notf_coal_needed,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(rx_coal.max_packets, VirtIONet),
+        VMSTATE_UINT32(rx_coal.max_usecs, VirtIONet),
+        VMSTATE_UINT32(tx_coal.max_packets, VirtIONet),
+        VMSTATE_UINT32(tx_coal.max_usecs, VirtIONet),
+        VMSTATE_END_OF_LIST()
+    },
+};
+
 static const VMStateDescription vmstate_virtio_net_device = {
     .name = "virtio-net-device",
     .version_id = VIRTIO_NET_VM_VERSION,
@@ -3348,6 +3524,7 @@ static const VMStateDescription vmstate_virtio_net_device = {
     },
     .subsections = (const VMStateDescription * const []) {
         &vmstate_virtio_net_rss,
+        &vmstate_virtio_net_notf_coal,
         NULL
     }
 };
@@ -3774,6 +3951,9 @@ static void virtio_net_device_unrealize(DeviceState *dev)
         virtio_net_unload_ebpf(n);
     }
 
+    /* Don't leave our filter behind on a backend that may be reused */
+    virtio_net_update_backend_rx_filter(n, false);
+
     /* This will stop vhost backend if appropriate. */
     virtio_net_set_status(vdev, 0);
 
@@ -3835,6 +4015,7 @@ static void virtio_net_reset(VirtIODevice *vdev)
     memcpy(&n->mac[0], &n->nic->conf->macaddr, sizeof(n->mac));
     qemu_format_nic_info_str(qemu_get_queue(n->nic), n->mac);
     memset(n->vlans, 0, MAX_VLAN >> 3);
+    virtio_net_update_backend_rx_filter(n, true);
 
     /* Flush any async TX */
     for (i = 0;  i < n->max_queue_pairs; i++) {
@@ -3842,6 +4023,10 @@ static void virtio_net_reset(VirtIODevice *vdev)
     }
 
     virtio_net_disable_rss(n);
+
+    /* The virtqueues return to their default policy on their own */
+    memset(&n->rx_coal, 0, sizeof(n->rx_coal));
+    memset(&n->tx_coal, 0, sizeof(n->tx_coal));
 }
 
 static void virtio_net_instance_init(Object *obj)
@@ -3977,6 +4162,8 @@ static Property virtio_net_properties[] = {
                       ebpf_rss_fds, qdev_prop_string, char*),
     DEFINE_PROP_BIT64("guest_rsc_ext", VirtIONet, host_features,
                     VIRTIO_NET_F_RSC_EXT, false),
+    DEFINE_PROP_BIT64("notf_coal", VirtIONet, host_features,
+                    VIRTIO_NET_F_NOTF_COAL, false),
     DEFINE_PROP_UINT32("rsc_interval", VirtIONet, rsc_timeout,
                        VIRTIO_NET_RSC_DEFAULT_INTERVAL),
     DEFINE_NIC_PROPERTIES(VirtIONet, nic_conf),
@@ -3994,6 +4181,7 @@ static Property virtio_net_properties[] = {
     DEFINE_PROP_INT32("speed", VirtIONet, net_conf.speed, SPEED_UNKNOWN),
     DEFINE_PROP_STRING("duplex", VirtIONet, net_conf.duplex_str),
     DEFINE_PROP_BOOL("failover", VirtIONet, failover, false),
+    DEFINE_PROP_BOOL("rx-filter-offload", VirtIONet, rx_filter_offload, true),
     DEFINE_PROP_BIT64("guest_uso4", VirtIONet, host_features,
                       VIRTIO_NET_F_GUEST_USO4, true),
     DEFINE_PROP_BIT64("guest_uso6", VirtIONet, host_features,
@@ -204,23 +204,33 @@ static bool vhost_svq_add_split(VhostShadowVirtqueue *svq,
 
     /*
      * Put the entry in the available array (but don't update avail->idx until
-     * they do sync).
+     * vhost_svq_kick(), so a batch of entries is exposed at once).
      */
     avail_idx = svq->shadow_avail_idx & (svq->vring.num - 1);
     avail->ring[avail_idx] = cpu_to_le16(*head);
     svq->shadow_avail_idx++;
 
-    /* Update the avail index after write the descriptor */
-    smp_wmb();
-    avail->idx = cpu_to_le16(svq->shadow_avail_idx);
-
     return true;
 }
 
+/**
+ * Expose all the entries added since the last call to the device, and
+ * notify it if needed.
+ */
 static void vhost_svq_kick(VhostShadowVirtqueue *svq)
 {
+    uint16_t old_avail_idx = svq->published_avail_idx;
     bool needs_kick;
 
+    if (old_avail_idx == svq->shadow_avail_idx) {
+        return;
+    }
+
+    /* Update the avail index after write the descriptor */
+    smp_wmb();
+    svq->vring.avail->idx = cpu_to_le16(svq->shadow_avail_idx);
+    svq->published_avail_idx = svq->shadow_avail_idx;
+
     /*
      * We need to expose the available array entries before checking the used
      * flags
@@ -229,7 +239,8 @@ static void vhost_svq_kick(VhostShadowVirtqueue *svq)
 
     if (virtio_vdev_has_feature(svq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
         uint16_t avail_event = *(uint16_t *)(&svq->vring.used->ring[svq->vring.num]);
-        needs_kick = vring_need_event(avail_event, svq->shadow_avail_idx, svq->shadow_avail_idx - 1);
+        needs_kick = vring_need_event(avail_event, svq->shadow_avail_idx,
+                                      old_avail_idx);
     } else {
         needs_kick = !(svq->vring.used->flags & VRING_USED_F_NO_NOTIFY);
     }
@@ -241,14 +252,14 @@ static void vhost_svq_kick(VhostShadowVirtqueue *svq)
     event_notifier_set(&svq->hdev_kick);
 }
 
-/**
- * Add an element to a SVQ.
- *
- * Return -EINVAL if element is invalid, -ENOSPC if dev queue is full
+/*
+ * Add the buffers to the SVQ avail ring without exposing them to the device
+ * yet, see vhost_svq_kick().
  */
-int vhost_svq_add(VhostShadowVirtqueue *svq, const struct iovec *out_sg,
-                  size_t out_num, const struct iovec *in_sg, size_t in_num,
-                  VirtQueueElement *elem)
+static int vhost_svq_add_nokick(VhostShadowVirtqueue *svq,
+                                const struct iovec *out_sg, size_t out_num,
+                                const struct iovec *in_sg, size_t in_num,
+                                VirtQueueElement *elem)
 {
     unsigned qemu_head;
     unsigned ndescs = in_num + out_num;
@@ -266,16 +277,35 @@ int vhost_svq_add(VhostShadowVirtqueue *svq, const struct iovec *out_sg,
     svq->num_free -= ndescs;
     svq->desc_state[qemu_head].elem = elem;
     svq->desc_state[qemu_head].ndescs = ndescs;
-    vhost_svq_kick(svq);
     return 0;
 }
 
-/* Convenience wrapper to add a guest's element to SVQ */
+/**
+ * Add an element to a SVQ.
+ *
+ * Return -EINVAL if element is invalid, -ENOSPC if dev queue is full
+ */
+int vhost_svq_add(VhostShadowVirtqueue *svq, const struct iovec *out_sg,
+                  size_t out_num, const struct iovec *in_sg, size_t in_num,
+                  VirtQueueElement *elem)
+{
+    int r = vhost_svq_add_nokick(svq, out_sg, out_num, in_sg, in_num, elem);
+
+    if (r == 0) {
+        vhost_svq_kick(svq);
+    }
+    return r;
+}
+
+/*
+ * Convenience wrapper to add a guest's element to SVQ.  The caller kicks the
+ * device once for the whole batch.
+ */
 static int vhost_svq_add_element(VhostShadowVirtqueue *svq,
                                  VirtQueueElement *elem)
 {
-    return vhost_svq_add(svq, elem->out_sg, elem->out_num, elem->in_sg,
-                         elem->in_num, elem);
+    return vhost_svq_add_nokick(svq, elem->out_sg, elem->out_num, elem->in_sg,
+                                elem->in_num, elem);
 }
 
 /**
@@ -336,12 +366,15 @@ static void vhost_handle_guest_kick(VhostShadowVirtqueue *svq)
                 }
 
                 /* VQ is full or broken, just return and ignore kicks */
+                vhost_svq_kick(svq);
                 return;
             }
             /* elem belongs to SVQ or external caller now */
             elem = NULL;
         }
 
+        /* Forward the whole batch to the device at once */
+        vhost_svq_kick(svq);
         virtio_queue_set_notification(svq->vq, true);
     } while (!virtio_queue_empty(svq->vq));
 }
@@ -664,6 +697,7 @@ void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
     event_notifier_set_handler(&svq->hdev_call, vhost_svq_handle_call);
     svq->next_guest_avail_elem = NULL;
     svq->shadow_avail_idx = 0;
+    svq->published_avail_idx = 0;
     svq->shadow_used_idx = 0;
     svq->last_used_idx = 0;
     svq->vdev = vdev;
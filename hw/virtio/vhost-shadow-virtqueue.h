@@ -99,6 +99,9 @@ typedef struct VhostShadowVirtqueue {
     /* Next head to expose to the device */
     uint16_t shadow_avail_idx;
 
+    /* Avail idx last published to the device */
+    uint16_t published_avail_idx;
+
     /* Next free descriptor */
     uint16_t free_head;
 
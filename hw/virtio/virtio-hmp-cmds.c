@@ -241,6 +241,14 @@ void hmp_virtio_queue_status(Monitor *mon, const QDict *qdict)
                    s->signalled_used);
     monitor_printf(mon, "  signalled_used_valid: %s\n",
                    s->signalled_used_valid ? "true" : "false");
+    monitor_printf(mon, "  coalesce_max_packets: %"PRIu32"\n",
+                   s->coalesce_max_packets);
+    monitor_printf(mon, "  coalesce_max_usecs:   %"PRIu32"\n",
+                   s->coalesce_max_usecs);
+    monitor_printf(mon, "  coalesce_adaptive:    %s\n",
+                   s->coalesce_adaptive ? "true" : "false");
+    monitor_printf(mon, "  coalesce_pending:     %"PRIu32"\n",
+                   s->coalesce_pending);
     if (s->has_last_avail_idx) {
         monitor_printf(mon, "  last_avail_idx:       %d\n",
                        s->last_avail_idx);
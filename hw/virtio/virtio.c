@@ -152,6 +152,16 @@ struct VirtQueue
     EventNotifier guest_notifier;
     EventNotifier host_notifier;
     bool host_notifier_enabled;
+    VirtQueueElementPool *element_pool;
+
+    /* Notification coalescing, see virtio_queue_set_notification_coalescing() */
+    uint32_t coal_max_packets;
+    uint32_t coal_max_usecs;
+    bool coal_adaptive;
+    /* Used buffers completed since the last notification */
+    uint32_t coal_pending;
+    int64_t coal_last_ns;
+    QEMUTimer *coal_timer;
     QLIST_ENTRY(VirtQueue) node;
 };
 
@@ -1158,6 +1168,15 @@ void virtqueue_flush(VirtQueue *vq, unsigned int count)
     } else {
         virtqueue_split_flush(vq, count);
     }
+
+    /*
+     * Only count completions while a coalescing policy is set, so that the
+     * counter starts from zero after each notification.  Flushes can come
+     * from an iothread while the coalescing timer runs in the main loop.
+     */
+    if (vq->coal_timer) {
+        qatomic_add(&vq->coal_pending, count);
+    }
 }
 
 void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
@@ -1168,6 +1187,22 @@ void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
     virtqueue_flush(vq, 1);
 }
 
+/*
+ * Return @count elements to the guest with a single used index update
+ * (and thus a single write barrier), rather than one per element.
+ */
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement *const *elems,
+                          const unsigned int *lens, unsigned int count)
+{
+    unsigned int i;
+
+    RCU_READ_LOCK_GUARD();
+    for (i = 0; i < count; i++) {
+        virtqueue_fill(vq, elems[i], lens[i], i);
+    }
+    virtqueue_flush(vq, count);
+}
+
 /* Called within rcu_read_lock().  */
 static int virtqueue_num_heads(VirtQueue *vq, unsigned int idx)
 {
@@ -1648,9 +1683,144 @@ void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem)
                                                                         false);
 }
 
-static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
+/*
+ * Element pools keep freed elements around for reuse, in power-of-two size
+ * classes from 1 << VIRTQUEUE_ELEMENT_POOL_MIN_SHIFT bytes upwards.
+ * Elements larger than the biggest class are always allocated with
+ * g_malloc().
+ */
+#define VIRTQUEUE_ELEMENT_POOL_MIN_SHIFT 9
+#define VIRTQUEUE_ELEMENT_POOL_CLASSES 4
+#define VIRTQUEUE_ELEMENT_POOL_MAX_FREE 128
+
+typedef struct VirtQueueFreeElement {
+    QSLIST_ENTRY(VirtQueueFreeElement) next;
+} VirtQueueFreeElement;
+
+typedef QSLIST_HEAD(, VirtQueueFreeElement) VirtQueueFreeElementList;
+
+struct VirtQueueElementPool {
+    /*
+     * One reference for the owning VirtQueue and one for each element that
+     * was handed out and not freed yet.
+     */
+    unsigned int refcnt;
+
+    /* Only accessed by the thread that pops elements from the queue */
+    VirtQueueFreeElementList alloc[VIRTQUEUE_ELEMENT_POOL_CLASSES];
+
+    /*
+     * Elements are freed here by any thread and moved over to @alloc in one
+     * go once it runs empty, like the coroutine pool does.
+     */
+    VirtQueueFreeElementList release[VIRTQUEUE_ELEMENT_POOL_CLASSES];
+
+    /* Number of cached elements in @alloc and @release together */
+    unsigned int nr_free[VIRTQUEUE_ELEMENT_POOL_CLASSES];
+};
+
+static VirtQueueElementPool *virtqueue_element_pool_new(void)
+{
+    VirtQueueElementPool *pool = g_new0(VirtQueueElementPool, 1);
+
+    pool->refcnt = 1;
+    return pool;
+}
+
+static void virtqueue_element_pool_unref(VirtQueueElementPool *pool)
+{
+    VirtQueueFreeElement *free_elem;
+    int i;
+
+    if (qatomic_fetch_dec(&pool->refcnt) != 1) {
+        return;
+    }
+
+    for (i = 0; i < VIRTQUEUE_ELEMENT_POOL_CLASSES; i++) {
+        while ((free_elem = QSLIST_FIRST(&pool->alloc[i]))) {
+            QSLIST_REMOVE_HEAD(&pool->alloc[i], next);
+            g_free(free_elem);
+        }
+        while ((free_elem = QSLIST_FIRST(&pool->release[i]))) {
+            QSLIST_REMOVE_HEAD(&pool->release[i], next);
+            g_free(free_elem);
+        }
+    }
+    g_free(pool);
+}
+
+static VirtQueueElement *virtqueue_element_pool_get(VirtQueueElementPool *pool,
+                                                    size_t size)
 {
+    VirtQueueFreeElement *free_elem;
     VirtQueueElement *elem;
+    unsigned int class = 0;
+
+    while (size > (1ULL << (VIRTQUEUE_ELEMENT_POOL_MIN_SHIFT + class))) {
+        if (++class == VIRTQUEUE_ELEMENT_POOL_CLASSES) {
+            return NULL;
+        }
+    }
+
+    if (QSLIST_EMPTY(&pool->alloc[class])) {
+        /* Synchronizes with QSLIST_INSERT_HEAD_ATOMIC in the release path */
+        QSLIST_MOVE_ATOMIC(&pool->alloc[class], &pool->release[class]);
+    }
+
+    free_elem = QSLIST_FIRST(&pool->alloc[class]);
+    if (free_elem) {
+        QSLIST_REMOVE_HEAD(&pool->alloc[class], next);
+        qatomic_dec(&pool->nr_free[class]);
+        elem = (VirtQueueElement *)free_elem;
+    } else {
+        elem = g_malloc(1ULL << (VIRTQUEUE_ELEMENT_POOL_MIN_SHIFT + class));
+    }
+
+    qatomic_inc(&pool->refcnt);
+    elem->pool = pool;
+    elem->pool_class = class;
+    return elem;
+}
+
+void virtqueue_element_free(void *opaque)
+{
+    VirtQueueElement *elem = opaque;
+    VirtQueueElementPool *pool;
+    unsigned int class;
+
+    if (!elem) {
+        return;
+    }
+
+    pool = elem->pool;
+    if (!pool) {
+        g_free(elem);
+        return;
+    }
+
+    class = elem->pool_class;
+    if (qatomic_fetch_inc(&pool->nr_free[class]) <
+        VIRTQUEUE_ELEMENT_POOL_MAX_FREE) {
+        QSLIST_INSERT_HEAD_ATOMIC(&pool->release[class],
+                                  (VirtQueueFreeElement *)elem, next);
+    } else {
+        qatomic_dec(&pool->nr_free[class]);
+        g_free(elem);
+    }
+    virtqueue_element_pool_unref(pool);
+}
+
+void virtio_queue_enable_element_pool(VirtQueue *vq)
+{
+    if (!vq->element_pool) {
+        vq->element_pool = virtqueue_element_pool_new();
+    }
+}
+
+static void *virtqueue_alloc_element(VirtQueueElementPool *pool, size_t sz,
+                                     unsigned out_num, unsigned in_num)
+{
+    VirtQueueElement *elem = NULL;
     size_t in_addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
     size_t out_addr_ofs = in_addr_ofs + in_num * sizeof(elem->in_addr[0]);
     size_t out_addr_end = out_addr_ofs + out_num * sizeof(elem->out_addr[0]);
@@ -1659,7 +1829,13 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     size_t out_sg_end = out_sg_ofs + out_num * sizeof(elem->out_sg[0]);
 
     assert(sz >= sizeof(VirtQueueElement));
-    elem = g_malloc(out_sg_end);
+    if (pool) {
+        elem = virtqueue_element_pool_get(pool, out_sg_end);
+    }
+    if (!elem) {
+        elem = g_malloc(out_sg_end);
+        elem->pool = NULL;
+    }
     trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
     elem->out_num = out_num;
     elem->in_num = in_num;
@@ -1670,7 +1846,8 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+static void *virtqueue_split_pop(VirtQueue *vq, size_t sz,
+                                 bool set_avail_event)
 {
     unsigned int i, head, max, idx;
     VRingMemoryRegionCaches *caches;
@@ -1709,7 +1886,8 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         goto done;
     }
 
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+    if (set_avail_event &&
+        virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
         vring_set_avail_event(vq, vq->last_avail_idx);
     }
 
@@ -1784,7 +1962,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(vq->element_pool, sz, out_num, in_num);
     elem->index = head;
     elem->ndescs = 1;
     for (i = 0; i < out_num; i++) {
@@ -1924,7 +2102,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(vq->element_pool, sz, out_num, in_num);
     for (i = 0; i < out_num; i++) {
         elem->out_addr[i] = addr[i];
         elem->out_sg[i] = iov[i];
@@ -1974,10 +2152,54 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
         return virtqueue_packed_pop(vq, sz);
     } else {
-        return virtqueue_split_pop(vq, sz);
+        return virtqueue_split_pop(vq, sz, true);
     }
 }
 
+/*
+ * Pop up to @max elements in one go.  The region caches are looked up
+ * under a single RCU critical section and, for split rings, the avail
+ * event is published once for the whole batch instead of once per
+ * element.  Returns the number of elements stored in @elems.
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max)
+{
+    VirtIODevice *vdev = vq->vdev;
+    bool packed;
+    uint16_t last_avail_idx;
+    unsigned int n = 0;
+
+    if (virtio_device_disabled(vdev)) {
+        return 0;
+    }
+
+    packed = virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED);
+    last_avail_idx = vq->last_avail_idx;
+
+    RCU_READ_LOCK_GUARD();
+    while (n < max) {
+        void *elem = packed ? virtqueue_packed_pop(vq, sz) :
+                              virtqueue_split_pop(vq, sz, false);
+        if (!elem) {
+            break;
+        }
+        elems[n++] = elem;
+    }
+
+    /*
+     * Compare against the starting index rather than @n: a head may have
+     * been consumed by a pop that failed part way through.
+     */
+    if (!packed && vq->last_avail_idx != last_avail_idx &&
+        virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+
+    trace_virtqueue_pop_batch(vq, n, max);
+    return n;
+}
+
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
 {
     VRingMemoryRegionCaches *caches;
@@ -2113,7 +2335,7 @@ void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz)
     assert(ARRAY_SIZE(data.in_addr) >= data.in_num);
     assert(ARRAY_SIZE(data.out_addr) >= data.out_num);
 
-    elem = virtqueue_alloc_element(sz, data.out_num, data.in_num);
+    elem = virtqueue_alloc_element(NULL, sz, data.out_num, data.in_num);
     elem->index = data.index;
 
     for (i = 0; i < elem->in_num; i++) {
@@ -2281,6 +2503,17 @@ static void __virtio_queue_reset(VirtIODevice *vdev, uint32_t i)
     vdev->vq[i].notification = true;
     vdev->vq[i].vring.num = vdev->vq[i].vring.num_default;
     vdev->vq[i].inuse = 0;
+    if (vdev->vq[i].coal_timer) {
+        /* The driver is not interested in notifications held back so far */
+        timer_del(vdev->vq[i].coal_timer);
+    }
+    vdev->vq[i].coal_pending = 0;
+    if (vdev->vq[i].vring.num_default) {
+        virtio_queue_set_notification_coalescing(&vdev->vq[i],
+                                                 vdev->coalesce_max_packets,
+                                                 vdev->coalesce_max_usecs,
+                                                 vdev->coalesce_adaptive);
+    }
     virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
 }
 
@@ -2550,6 +2783,10 @@ VirtQueue *virtio_add_queue(VirtIODevice *vdev, int queue_size,
     vdev->vq[i].vring.align = VIRTIO_PCI_VRING_ALIGN;
     vdev->vq[i].handle_output = handle_output;
     vdev->vq[i].used_elems = g_new0(VirtQueueElement, queue_size);
+    virtio_queue_set_notification_coalescing(&vdev->vq[i],
+                                             vdev->coalesce_max_packets,
+                                             vdev->coalesce_max_usecs,
+                                             vdev->coalesce_adaptive);
 
     return &vdev->vq[i];
 }
@@ -2561,6 +2798,13 @@ void virtio_delete_queue(VirtQueue *vq)
     vq->handle_output = NULL;
     g_free(vq->used_elems);
     vq->used_elems = NULL;
+    if (vq->element_pool) {
+        virtqueue_element_pool_unref(vq->element_pool);
+        vq->element_pool = NULL;
+    }
+    timer_free(vq->coal_timer);
+    vq->coal_timer = NULL;
+    vq->coal_pending = 0;
     virtio_virtqueue_reset_region_cache(vq);
 }
 
@@ -2707,8 +2951,107 @@ static void virtio_irq(VirtQueue *vq)
     virtio_notify_vector(vq->vdev, vq->vector);
 }
 
+/* Deliver the notification that the coalescing policy held back */
+static void virtio_queue_coalesce_timer_cb(void *opaque)
+{
+    VirtQueue *vq = opaque;
+    bool notify;
+
+    trace_virtio_queue_coalesce_timer(vq->vdev, vq,
+                                      qatomic_xchg(&vq->coal_pending, 0));
+
+    vq->coal_last_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        notify = virtio_should_notify(vq->vdev, vq);
+    }
+    if (notify) {
+        virtio_irq(vq);
+    }
+}
+
+static void virtio_queue_coalesce_flush(VirtQueue *vq)
+{
+    if (vq->coal_timer && timer_pending(vq->coal_timer)) {
+        timer_del(vq->coal_timer);
+        virtio_queue_coalesce_timer_cb(vq);
+    }
+}
+
+/*
+ * Returns true if the notification for @vq must be held back because of the
+ * coalescing policy; the coalescing timer will deliver it later.  This must
+ * run before virtio_should_notify(), which records the used index that the
+ * driver is being notified about.
+ */
+static bool virtio_queue_coalesce(VirtQueue *vq)
+{
+    int64_t now;
+
+    if (!vq->coal_timer) {
+        return false;
+    }
+
+    now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+    if (vq->coal_max_packets &&
+        qatomic_read(&vq->coal_pending) >= vq->coal_max_packets) {
+        goto notify;
+    }
+
+    if (timer_pending(vq->coal_timer)) {
+        return true;
+    }
+
+    /*
+     * In adaptive mode a queue that has been idle for longer than the
+     * coalescing window is signalled right away, so that coalescing only
+     * adds latency while completions arrive back to back.
+     */
+    if (vq->coal_adaptive &&
+        now - vq->coal_last_ns >= vq->coal_max_usecs * SCALE_US) {
+        goto notify;
+    }
+
+    timer_mod(vq->coal_timer, now + vq->coal_max_usecs * SCALE_US);
+    return true;
+
+notify:
+    timer_del(vq->coal_timer);
+    qatomic_set(&vq->coal_pending, 0);
+    vq->coal_last_ns = now;
+    return false;
+}
+
+void virtio_queue_set_notification_coalescing(VirtQueue *vq,
+                                              uint32_t max_packets,
+                                              uint32_t max_usecs,
+                                              bool adaptive)
+{
+    trace_virtio_queue_set_notification_coalescing(vq->vdev, vq, max_packets,
+                                                   max_usecs, adaptive);
+
+    vq->coal_max_packets = max_packets;
+    vq->coal_max_usecs = max_usecs;
+    vq->coal_adaptive = adaptive;
+
+    if (!max_usecs || max_packets == 1) {
+        virtio_queue_coalesce_flush(vq);
+        timer_free(vq->coal_timer);
+        vq->coal_timer = NULL;
+        qatomic_set(&vq->coal_pending, 0);
+    } else if (!vq->coal_timer) {
+        vq->coal_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                      virtio_queue_coalesce_timer_cb, vq);
+    }
+}
+
 void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
 {
+    if (virtio_queue_coalesce(vq)) {
+        return;
+    }
+
     WITH_RCU_READ_LOCK_GUARD() {
         if (!virtio_should_notify(vdev, vq)) {
             return;
@@ -2719,6 +3062,35 @@ void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
     virtio_irq(vq);
 }
 
+static void virtio_notify_deferred_fn(void *opaque)
+{
+    VirtQueue *vq = opaque;
+
+    trace_virtio_notify_deferred_fn(vq->vdev, vq);
+    virtio_notify_vector(vq->vdev, vq->vector);
+}
+
+/*
+ * Like virtio_notify(), but coalesce the interrupts for @vq while inside a
+ * defer_call_begin()/defer_call_end() section.
+ */
+void virtio_notify_deferred(VirtIODevice *vdev, VirtQueue *vq)
+{
+    if (virtio_queue_coalesce(vq)) {
+        return;
+    }
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        if (!virtio_should_notify(vdev, vq)) {
+            return;
+        }
+    }
+
+    trace_virtio_notify(vdev, vq);
+    virtio_set_isr(vq->vdev, 0x1);
+    defer_call(virtio_notify_deferred_fn, vq);
+}
+
 void virtio_notify_config(VirtIODevice *vdev)
 {
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK))
@@ -3418,8 +3790,20 @@ static void virtio_vmstate_change(void *opaque, bool running, RunState state)
     BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
     bool backend_run = running && virtio_device_started(vdev, vdev->status);
+    int i;
+
     vdev->vm_running = running;
 
+    /*
+     * The virtual clock stops with the VM, and a held back notification
+     * would be lost if the VM is migrated now: deliver them all.
+     */
+    if (!running) {
+        for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
+            virtio_queue_coalesce_flush(&vdev->vq[i]);
+        }
+    }
+
     if (backend_run) {
         virtio_set_status(vdev, vdev->status);
     }
@@ -3991,6 +4375,7 @@ static void virtio_device_free_virtqueues(VirtIODevice *vdev)
             break;
         }
         virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
+        timer_free(vdev->vq[i].coal_timer);
     }
     g_free(vdev->vq);
 }
@@ -4011,6 +4396,12 @@ static Property virtio_properties[] = {
     DEFINE_PROP_BOOL("use-disabled-flag", VirtIODevice, use_disabled_flag, true),
     DEFINE_PROP_BOOL("x-disable-legacy-check", VirtIODevice,
                      disable_legacy_check, false),
+    DEFINE_PROP_UINT32("x-coalesce-max-packets", VirtIODevice,
+                       coalesce_max_packets, 0),
+    DEFINE_PROP_UINT32("x-coalesce-max-usecs", VirtIODevice,
+                       coalesce_max_usecs, 0),
+    DEFINE_PROP_BOOL("x-coalesce-adaptive", VirtIODevice,
+                     coalesce_adaptive, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -4189,6 +4580,10 @@ VirtQueueStatus *qmp_x_query_virtio_queue_status(const char *path,
     status->used_idx = vdev->vq[queue].used_idx;
     status->signalled_used = vdev->vq[queue].signalled_used;
     status->signalled_used_valid = vdev->vq[queue].signalled_used_valid;
+    status->coalesce_max_packets = vdev->vq[queue].coal_max_packets;
+    status->coalesce_max_usecs = vdev->vq[queue].coal_max_usecs;
+    status->coalesce_adaptive = vdev->vq[queue].coal_adaptive;
+    status->coalesce_pending = qatomic_read(&vdev->vq[queue].coal_pending);
 
     if (vdev->vhost_started) {
         VirtioDeviceClass *vdc = VIRTIO_DEVICE_GET_CLASS(vdev);
@@ -101,4 +101,14 @@ BdrvDirtyBitmap *block_copy_dirty_bitmap(BlockCopyState *s);
 int64_t block_copy_cluster_size(BlockCopyState *s);
 void block_copy_set_skip_unallocated(BlockCopyState *s, bool skip);
 
+/*
+ * Latency histograms of the copy tasks run so far, for tasks offloaded to the
+ * storage (copy_range and write-zeroes) and for tasks going through a bounce
+ * buffer respectively.  The caller owns the returned object.
+ */
+BlockLatencyHistogramInfo *
+block_copy_offload_latency_histogram(BlockCopyState *s);
+BlockLatencyHistogramInfo *
+block_copy_bounce_latency_histogram(BlockCopyState *s);
+
 #endif /* BLOCK_COPY_H */
@@ -57,6 +57,13 @@ struct RAMBlock {
      */
     off_t bitmap_offset;
     uint64_t pages_offset;
+    /*
+     * file_bmap and layout of the last completed incremental mapped-ram
+     * migration, which the next one only needs to update.
+     */
+    unsigned long *parent_file_bmap;
+    uint64_t parent_pages_offset;
+    ram_addr_t parent_used_length;
 
     /* Bitmap of already received pages.  Only used on destination side. */
     unsigned long *receivedmap;
@@ -215,6 +215,7 @@ struct VirtIONet {
     AnnounceTimer announce_timer;
     bool needs_vnet_hdr_swap;
     bool mtu_bypass_backend;
+    bool rx_filter_offload;
     /* primary failover device is hidden*/
     bool failover_primary_hidden;
     bool failover;
@@ -223,6 +224,9 @@ struct VirtIONet {
     bool primary_opts_from_json;
     NotifierWithReturn migration_state;
     VirtioNetRssData rss_data;
+    /* Notification coalescing set with VIRTIO_NET_CTRL_NOTF_COAL */
+    struct virtio_net_ctrl_coal rx_coal;
+    struct virtio_net_ctrl_coal tx_coal;
     struct NetRxPkt *rx_pkt;
     struct EBPFRSSContext ebpf_rss;
     uint32_t nr_ebpf_rss_fds;
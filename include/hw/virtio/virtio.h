@@ -59,6 +59,7 @@ size_t virtio_get_config_size(const VirtIOConfigSizeParams *params,
                               uint64_t host_features);
 
 typedef struct VirtQueue VirtQueue;
+typedef struct VirtQueueElementPool VirtQueueElementPool;
 
 #define VIRTQUEUE_MAX_SIZE 1024
 
@@ -75,6 +76,9 @@ typedef struct VirtQueueElement
     hwaddr *out_addr;
     struct iovec *in_sg;
     struct iovec *out_sg;
+    /* Pool the element came from, see virtio_queue_enable_element_pool() */
+    VirtQueueElementPool *pool;
+    unsigned int pool_class;
 } VirtQueueElement;
 
 #define VIRTIO_QUEUE_MAX 1024
@@ -150,6 +154,10 @@ struct VirtIODevice
     bool start_on_kick; /* when virtio 1.0 feature has not been negotiated */
     bool disable_legacy_check;
     bool vhost_started;
+    /* Default notification coalescing policy of the virtqueues */
+    uint32_t coalesce_max_packets;
+    uint32_t coalesce_max_usecs;
+    bool coalesce_adaptive;
     VMChangeStateEntry *vmstate;
     char *bus_name;
     uint8_t device_endian;
@@ -255,8 +263,21 @@ void virtio_del_queue(VirtIODevice *vdev, int n);
 
 void virtio_delete_queue(VirtQueue *vq);
 
+/*
+ * virtio_queue_enable_element_pool:
+ * Serve elements popped from @vq from a per-queue free list instead of
+ * allocating each one with g_malloc().  A device that enables this must free
+ * all elements, including ones it got from qemu_get_virtqueue_element(),
+ * with virtqueue_element_free().  Elements may be freed from any thread and
+ * may outlive the queue itself.
+ */
+void virtio_queue_enable_element_pool(VirtQueue *vq);
+void virtqueue_element_free(void *elem);
+
 void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
                     unsigned int len);
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement *const *elems,
+                          const unsigned int *lens, unsigned int count);
 void virtqueue_flush(VirtQueue *vq, unsigned int count);
 void virtqueue_detach_element(VirtQueue *vq, const VirtQueueElement *elem,
                               unsigned int len);
@@ -268,6 +289,8 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
 
 void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem);
 void *virtqueue_pop(VirtQueue *vq, size_t sz);
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max);
 unsigned int virtqueue_drop_all(VirtQueue *vq);
 void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz);
 void qemu_put_virtqueue_element(VirtIODevice *vdev, QEMUFile *f,
@@ -284,6 +307,24 @@ int virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
 
 void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq);
 void virtio_notify(VirtIODevice *vdev, VirtQueue *vq);
+void virtio_notify_deferred(VirtIODevice *vdev, VirtQueue *vq);
+
+/**
+ * virtio_queue_set_notification_coalescing() - coalesce used buffer
+ * notifications
+ * @vq: the virtqueue
+ * @max_packets: notify once this many used buffers are pending (0: no limit)
+ * @max_usecs: maximum time a notification is held back (0: no coalescing)
+ * @adaptive: notify right away if @vq was idle for longer than @max_usecs
+ *
+ * Applies to notifications sent with virtio_notify() and
+ * virtio_notify_deferred().  Device reset restores the values of the
+ * x-coalesce-* properties.
+ */
+void virtio_queue_set_notification_coalescing(VirtQueue *vq,
+                                              uint32_t max_packets,
+                                              uint32_t max_usecs,
+                                              bool adaptive);
 
 int virtio_save(VirtIODevice *vdev, QEMUFile *f);
 
@@ -90,6 +90,22 @@ enum KVMDirtyRingReaperState {
     KVM_DIRTY_RING_REAPER_REAPING,
 };
 
+/*
+ * Part @index out of @nr of a job split between the reaper helpers and
+ * the thread that requested it.
+ */
+typedef uint64_t (*KVMDirtyRingJob)(KVMState *s, void *opaque,
+                                    int index, int nr);
+
+/* Helper thread reaping dirty rings and merging slot bitmaps */
+typedef struct KVMDirtyRingWorker {
+    QemuThread thread;
+    QemuSemaphore sem;
+    int index;
+    /* Result of the worker's part of the last job */
+    uint64_t total;
+} KVMDirtyRingWorker;
+
 /*
  * KVM reaper instance, responsible for collecting the KVM dirty bits
  * via the dirty ring.
@@ -99,6 +115,13 @@ struct KVMDirtyRingReaper {
     QemuThread reaper_thr;
     volatile uint64_t reaper_iteration; /* iteration number of reaper thr */
     volatile enum KVMDirtyRingReaperState reaper_state; /* reap thr state */
+    /* Threads sharing a job, the requesting one included */
+    int nr_threads;
+    KVMDirtyRingWorker *workers;
+    QemuSemaphore workers_done;
+    /* Job being run, only changed with the slots lock held */
+    KVMDirtyRingJob job;
+    void *job_opaque;
 };
 struct KVMState
 {
@@ -155,6 +178,7 @@ struct KVMState
     } *as;
     uint64_t kvm_dirty_ring_bytes;  /* Size of the per-vcpu dirty ring */
     uint32_t kvm_dirty_ring_size;   /* Number of dirty GFNs per ring */
+    uint32_t kvm_dirty_ring_reap_threads; /* 0 to size it from the vCPUs */
     bool kvm_dirty_ring_with_bitmap;
     uint64_t kvm_eager_split_size;  /* Eager Page Splitting chunk size */
     struct KVMDirtyRingReaper reaper;
@@ -529,6 +529,10 @@ static ssize_t qio_channel_socket_readv(QIOChannel *ioc,
         sflags |= MSG_PEEK;
     }
 
+    if (flags & QIO_CHANNEL_READ_FLAG_WAITALL) {
+        sflags |= MSG_WAITALL;
+    }
+
  retry:
     ret = recvmsg(sioc->fd, &msg, sflags);
     if (ret < 0) {
@@ -29,6 +29,10 @@
 #include "sysemu/runstate.h"
 #include "exec/memory.h"
 #include "qemu/xxhash.h"
+#include "qemu/units.h"
+#include "qemu/bitmap.h"
+#include "qemu/lockable.h"
+#include "sysemu/stats.h"
 
 /*
  * total_dirty_pages is procted by BQL and is used
@@ -928,3 +932,447 @@ void hmp_calc_dirty_rate(Monitor *mon, const QDict *qdict)
                    " seconds\n", sec);
     monitor_printf(mon, "[Please use 'info dirty_rate' to check results]\n");
 }
+
+/*
+ * Dirty page heatmap: a few pages of every region of guest memory are
+ * hashed once per period, and each region keeps a 64 bit history of the
+ * periods in which one of its sampled pages changed.
+ */
+typedef struct DirtyHeatmapBlock {
+    char *idstr;
+    uint8_t *host;
+    uint64_t used_length;
+    uint64_t nr_regions;
+    /* Bit 0 is the latest period; protected by heatmap.lock */
+    uint64_t *history;
+    /* Owned by the sampling thread */
+    unsigned long *dirty;
+    uint32_t *pages;
+    uint32_t *hashes;
+    uint64_t generation;
+    bool primed;
+    QTAILQ_ENTRY(DirtyHeatmapBlock) next;
+} DirtyHeatmapBlock;
+
+static struct {
+    /* Protects the block list and the history of each block */
+    QemuMutex lock;
+    QemuThread thread;
+    QemuSemaphore stop;
+    /* The fields below are only changed with the sampler stopped */
+    bool running;
+    int64_t period_ms;
+    int64_t sample_pages;
+    uint64_t generation;
+    uint64_t periods;
+    QTAILQ_HEAD(, DirtyHeatmapBlock) blocks;
+} heatmap;
+
+static DirtyHeatmapBlock *dirty_heatmap_block_new(RAMBlock *block)
+{
+    DirtyHeatmapBlock *hb = g_new0(DirtyHeatmapBlock, 1);
+    uint64_t sample_pages = heatmap.sample_pages;
+    uint64_t region, pages;
+    GRand *rand;
+    int i;
+
+    hb->idstr = g_strdup(qemu_ram_get_idstr(block));
+    hb->host = qemu_ram_get_host_addr(block);
+    hb->used_length = qemu_ram_get_used_length(block);
+    hb->nr_regions = DIV_ROUND_UP(hb->used_length, DIRTY_HEATMAP_REGION_SIZE);
+    hb->history = g_new0(uint64_t, hb->nr_regions);
+    hb->dirty = bitmap_new(hb->nr_regions);
+    hb->pages = g_new(uint32_t, hb->nr_regions * sample_pages);
+    hb->hashes = g_new(uint32_t, hb->nr_regions * sample_pages);
+
+    rand = g_rand_new();
+    for (region = 0; region < hb->nr_regions; region++) {
+        pages = MIN(DIRTY_HEATMAP_REGION_SIZE,
+                    hb->used_length - region * DIRTY_HEATMAP_REGION_SIZE) >>
+                qemu_target_page_bits();
+        for (i = 0; i < sample_pages; i++) {
+            hb->pages[region * sample_pages + i] =
+                g_rand_int_range(rand, 0, MAX(pages, 1));
+        }
+    }
+    g_rand_free(rand);
+
+    return hb;
+}
+
+static void dirty_heatmap_block_free(DirtyHeatmapBlock *hb)
+{
+    g_free(hb->idstr);
+    g_free(hb->history);
+    g_free(hb->dirty);
+    g_free(hb->pages);
+    g_free(hb->hashes);
+    g_free(hb);
+}
+
+static void dirty_heatmap_reset(void)
+{
+    DirtyHeatmapBlock *hb, *next_hb;
+
+    QEMU_LOCK_GUARD(&heatmap.lock);
+    QTAILQ_FOREACH_SAFE(hb, &heatmap.blocks, next, next_hb) {
+        QTAILQ_REMOVE(&heatmap.blocks, hb, next);
+        dirty_heatmap_block_free(hb);
+    }
+    heatmap.periods = 0;
+}
+
+/*
+ * Only the sampling thread adds or removes blocks, so it can walk the
+ * list without taking the lock.
+ */
+static DirtyHeatmapBlock *dirty_heatmap_find_block(RAMBlock *block)
+{
+    DirtyHeatmapBlock *hb, *new_hb;
+
+    QTAILQ_FOREACH(hb, &heatmap.blocks, next) {
+        if (g_str_equal(hb->idstr, qemu_ram_get_idstr(block))) {
+            break;
+        }
+    }
+
+    if (hb && hb->host == qemu_ram_get_host_addr(block) &&
+        hb->used_length == qemu_ram_get_used_length(block)) {
+        return hb;
+    }
+
+    /* The block is new, or was resized: start over */
+    new_hb = dirty_heatmap_block_new(block);
+
+    QEMU_LOCK_GUARD(&heatmap.lock);
+    if (hb) {
+        QTAILQ_INSERT_BEFORE(hb, new_hb, next);
+        QTAILQ_REMOVE(&heatmap.blocks, hb, next);
+        dirty_heatmap_block_free(hb);
+    } else {
+        QTAILQ_INSERT_TAIL(&heatmap.blocks, new_hb, next);
+    }
+    return new_hb;
+}
+
+static uint64_t dirty_heatmap_sample_block(DirtyHeatmapBlock *hb)
+{
+    size_t page_size = qemu_target_page_size();
+    uint64_t sample_pages = heatmap.sample_pages;
+    uint64_t region, dirty_regions = 0;
+    uint32_t *pages = hb->pages;
+    uint32_t *hashes = hb->hashes;
+    uint32_t hash;
+    bool dirty;
+    int i;
+
+    for (region = 0; region < hb->nr_regions; region++) {
+        uint8_t *base = hb->host + region * DIRTY_HEATMAP_REGION_SIZE;
+
+        dirty = false;
+        for (i = 0; i < sample_pages; i++, pages++, hashes++) {
+            hash = compute_page_hash(base + (uint64_t)*pages * page_size);
+            if (hash != *hashes) {
+                *hashes = hash;
+                dirty = true;
+            }
+        }
+
+        if (hb->primed && dirty) {
+            set_bit(region, hb->dirty);
+            dirty_regions++;
+        }
+    }
+
+    hb->generation = heatmap.generation;
+    if (!hb->primed) {
+        /* The first pass only records the initial hashes */
+        hb->primed = true;
+        return 0;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&heatmap.lock) {
+        for (region = 0; region < hb->nr_regions; region++) {
+            hb->history[region] = (hb->history[region] << 1) |
+                                  test_bit(region, hb->dirty);
+        }
+    }
+    bitmap_zero(hb->dirty, hb->nr_regions);
+
+    return dirty_regions;
+}
+
+static void dirty_heatmap_sample(bool count)
+{
+    DirtyHeatmapBlock *hb, *next_hb;
+    RAMBlock *block;
+    uint64_t dirty_regions = 0;
+
+    heatmap.generation++;
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH_MIGRATABLE(block) {
+            if (skip_sample_ramblock(block)) {
+                continue;
+            }
+            hb = dirty_heatmap_find_block(block);
+            dirty_regions += dirty_heatmap_sample_block(hb);
+        }
+    }
+
+    QEMU_LOCK_GUARD(&heatmap.lock);
+    QTAILQ_FOREACH_SAFE(hb, &heatmap.blocks, next, next_hb) {
+        if (hb->generation != heatmap.generation) {
+            QTAILQ_REMOVE(&heatmap.blocks, hb, next);
+            dirty_heatmap_block_free(hb);
+        }
+    }
+    if (count) {
+        heatmap.periods++;
+        trace_dirty_heatmap_sample(heatmap.periods, dirty_regions);
+    }
+}
+
+static void *dirty_heatmap_thread(void *opaque)
+{
+    rcu_register_thread();
+
+    dirty_heatmap_sample(false);
+    while (qemu_sem_timedwait(&heatmap.stop, heatmap.period_ms) < 0) {
+        dirty_heatmap_sample(true);
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void dirty_heatmap_stop(void)
+{
+    if (!heatmap.running) {
+        return;
+    }
+
+    qemu_sem_post(&heatmap.stop);
+    qemu_thread_join(&heatmap.thread);
+    heatmap.running = false;
+    trace_dirty_heatmap_stop(heatmap.periods);
+}
+
+void qmp_set_dirty_heatmap(bool enable,
+                           bool has_period, int64_t period,
+                           bool has_sample_pages, int64_t sample_pages,
+                           Error **errp)
+{
+    if (!enable) {
+        if (has_period || has_sample_pages) {
+            error_setg(errp, "period and sample-pages are only used when "
+                       "enabling the heatmap");
+            return;
+        }
+        dirty_heatmap_stop();
+        return;
+    }
+
+    if (!has_period) {
+        period = DIRTY_HEATMAP_DEFAULT_PERIOD_MS;
+    }
+    if (!is_calc_time_valid(period)) {
+        error_setg(errp, "period is out of range [%dms, %dms].",
+                   MIN_CALC_TIME_MS, MAX_CALC_TIME_MS);
+        return;
+    }
+
+    if (!has_sample_pages) {
+        sample_pages = 1;
+    }
+    if (sample_pages < 1 || sample_pages > DIRTY_HEATMAP_MAX_SAMPLE_PAGES) {
+        error_setg(errp, "sample-pages is out of range [1, %d].",
+                   DIRTY_HEATMAP_MAX_SAMPLE_PAGES);
+        return;
+    }
+
+    dirty_heatmap_stop();
+    dirty_heatmap_reset();
+
+    heatmap.period_ms = period;
+    heatmap.sample_pages = sample_pages;
+    heatmap.running = true;
+    trace_dirty_heatmap_start(period, sample_pages);
+    qemu_thread_create(&heatmap.thread, "dirty-heatmap",
+                       dirty_heatmap_thread, NULL, QEMU_THREAD_JOINABLE);
+}
+
+DirtyHeatmapInfo *qmp_query_dirty_heatmap(const char *ramblock,
+                                          bool has_max_regions,
+                                          uint64_t max_regions,
+                                          Error **errp)
+{
+    DirtyHeatmapInfo *info = g_new0(DirtyHeatmapInfo, 1);
+    DirtyHeatmapRegionList **tail = &info->regions;
+    DirtyHeatmapBlock *hb;
+    uint64_t region, nr_regions = 0;
+
+    info->enabled = heatmap.running;
+    info->period = heatmap.period_ms;
+    info->sample_pages = heatmap.sample_pages;
+    info->region_size = DIRTY_HEATMAP_REGION_SIZE;
+
+    QEMU_LOCK_GUARD(&heatmap.lock);
+    info->periods = heatmap.periods;
+    QTAILQ_FOREACH(hb, &heatmap.blocks, next) {
+        if (ramblock && !g_str_equal(hb->idstr, ramblock)) {
+            continue;
+        }
+        for (region = 0; region < hb->nr_regions; region++) {
+            DirtyHeatmapRegion *r;
+
+            if (!hb->history[region]) {
+                continue;
+            }
+            if (has_max_regions && nr_regions++ == max_regions) {
+                return info;
+            }
+            r = g_new0(DirtyHeatmapRegion, 1);
+            r->ramblock = g_strdup(hb->idstr);
+            r->offset = region * DIRTY_HEATMAP_REGION_SIZE;
+            r->history = hb->history[region];
+            QAPI_LIST_APPEND(tail, r);
+        }
+    }
+
+    return info;
+}
+
+/*
+ * The "dirty-periods" histogram counts the regions by the number of
+ * periods, out of the last 64, in which they were written to.
+ */
+#define DIRTY_HEATMAP_HISTOGRAM_BUCKET_SIZE   8
+#define DIRTY_HEATMAP_HISTOGRAM_BUCKETS       (64 / 8 + 1)
+
+static StatsList *dirty_heatmap_stats_add(StatsList *list, strList *names,
+                                          const char *name, uint64_t val)
+{
+    Stats *stats;
+
+    if (!apply_str_list_filter(name, names)) {
+        return list;
+    }
+
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QNUM;
+    stats->value->u.scalar = val;
+
+    QAPI_LIST_PREPEND(list, stats);
+    return list;
+}
+
+static void dirty_heatmap_stats_cb(StatsResultList **result,
+                                   StatsTarget target,
+                                   strList *names, strList *targets,
+                                   Error **errp)
+{
+    uint64_t histogram[DIRTY_HEATMAP_HISTOGRAM_BUCKETS] = { 0 };
+    uint64_t regions = 0, dirty_regions = 0, working_set = 0, periods = 0;
+    StatsList *stats_list = NULL;
+    DirtyHeatmapBlock *hb;
+    uint64_t region;
+    int i;
+
+    if (target != STATS_TARGET_VM) {
+        return;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&heatmap.lock) {
+        periods = heatmap.periods;
+        QTAILQ_FOREACH(hb, &heatmap.blocks, next) {
+            regions += hb->nr_regions;
+            for (region = 0; region < hb->nr_regions; region++) {
+                uint64_t history = hb->history[region];
+
+                dirty_regions += history & 1;
+                working_set += !!history;
+                histogram[ctpop64(history) /
+                          DIRTY_HEATMAP_HISTOGRAM_BUCKET_SIZE]++;
+            }
+        }
+    }
+
+    if (apply_str_list_filter("dirty-periods", names)) {
+        Stats *stats = g_new0(Stats, 1);
+        uint64List **tail;
+
+        stats->name = g_strdup("dirty-periods");
+        stats->value = g_new0(StatsValue, 1);
+        stats->value->type = QTYPE_QLIST;
+        tail = &stats->value->u.list;
+        for (i = 0; i < DIRTY_HEATMAP_HISTOGRAM_BUCKETS; i++) {
+            QAPI_LIST_APPEND(tail, histogram[i]);
+        }
+        QAPI_LIST_PREPEND(stats_list, stats);
+    }
+    stats_list = dirty_heatmap_stats_add(stats_list, names, "working-set",
+                     working_set * DIRTY_HEATMAP_REGION_SIZE);
+    stats_list = dirty_heatmap_stats_add(stats_list, names, "dirty-regions",
+                                         dirty_regions);
+    stats_list = dirty_heatmap_stats_add(stats_list, names, "periods",
+                                         periods);
+    stats_list = dirty_heatmap_stats_add(stats_list, names, "regions",
+                                         regions);
+
+    if (stats_list) {
+        add_stats_entry(result, STATS_PROVIDER_DIRTY_HEATMAP, NULL,
+                        stats_list);
+    }
+}
+
+static StatsSchemaValueList *dirty_heatmap_schemas_add(
+    StatsSchemaValueList *list, const char *name, StatsType type)
+{
+    StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+    value->name = g_strdup(name);
+    value->type = type;
+    if (type == STATS_TYPE_LINEAR_HISTOGRAM) {
+        value->has_bucket_size = true;
+        value->bucket_size = DIRTY_HEATMAP_HISTOGRAM_BUCKET_SIZE;
+    }
+
+    QAPI_LIST_PREPEND(list, value);
+    return list;
+}
+
+static void dirty_heatmap_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *stats_list = NULL;
+
+    stats_list = dirty_heatmap_schemas_add(stats_list, "dirty-periods",
+                                           STATS_TYPE_LINEAR_HISTOGRAM);
+    stats_list = dirty_heatmap_schemas_add(stats_list, "working-set",
+                                           STATS_TYPE_INSTANT);
+    stats_list->value->has_unit = true;
+    stats_list->value->unit = STATS_UNIT_BYTES;
+    stats_list = dirty_heatmap_schemas_add(stats_list, "dirty-regions",
+                                           STATS_TYPE_INSTANT);
+    stats_list = dirty_heatmap_schemas_add(stats_list, "periods",
+                                           STATS_TYPE_CUMULATIVE);
+    stats_list = dirty_heatmap_schemas_add(stats_list, "regions",
+                                           STATS_TYPE_INSTANT);
+
+    add_stats_schema(result, STATS_PROVIDER_DIRTY_HEATMAP, STATS_TARGET_VM,
+                     stats_list);
+}
+
+void dirty_heatmap_init(void)
+{
+    qemu_mutex_init(&heatmap.lock);
+    qemu_sem_init(&heatmap.stop, 0);
+    QTAILQ_INIT(&heatmap.blocks);
+    heatmap.period_ms = DIRTY_HEATMAP_DEFAULT_PERIOD_MS;
+    heatmap.sample_pages = 1;
+
+    add_stats_callbacks(STATS_PROVIDER_DIRTY_HEATMAP, dirty_heatmap_stats_cb,
+                        dirty_heatmap_schemas_cb);
+}
@@ -44,6 +44,14 @@
 #define MIN_SAMPLE_PAGE_COUNT                     128
 #define MAX_SAMPLE_PAGE_COUNT                     16384
 
+/*
+ * The dirty page heatmap tracks guest memory in regions of 2 MiB,
+ * sampling up to 64 pages in each of them.
+ */
+#define DIRTY_HEATMAP_REGION_SIZE                 (2 * MiB)
+#define DIRTY_HEATMAP_DEFAULT_PERIOD_MS           1000
+#define DIRTY_HEATMAP_MAX_SAMPLE_PAGES            64
+
 struct DirtyRateConfig {
     uint64_t sample_pages_per_gigabytes; /* sample pages per GB */
     int64_t calc_time_ms; /* desired calculation time (in milliseconds) */
@@ -84,4 +92,5 @@ struct DirtyRateStat {
 };
 
 void *get_dirtyrate_thread(void *arg);
+void dirty_heatmap_init(void);
 #endif
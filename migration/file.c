@@ -103,12 +103,24 @@ void file_start_outgoing_migration(MigrationState *s,
 
     trace_migration_file_outgoing(filename);
 
-    fioc = qio_channel_file_new_path(filename, O_CREAT | O_WRONLY, 0600, errp);
+    /*
+     * An incremental mapped-ram migration reads back the headers of the
+     * previous one to check that the file still holds its pages.
+     */
+    fioc = qio_channel_file_new_path(filename,
+                                     O_CREAT | (migrate_mapped_ram_incremental()
+                                                ? O_RDWR : O_WRONLY),
+                                     0600, errp);
     if (!fioc) {
         return;
     }
 
-    if (ftruncate(fioc->fd, offset)) {
+    /*
+     * An incremental mapped-ram migration only rewrites what changed
+     * since the previous one, keep the rest of the file.  Stale data
+     * past the end of the new stream is never read.
+     */
+    if (!migrate_mapped_ram_incremental() && ftruncate(fioc->fd, offset)) {
         error_setg_errno(errp, errno,
                          "failed to truncate migration file to offset %" PRIx64,
                          offset);
@@ -253,15 +265,20 @@ int file_write_ramblock_iov(QIOChannel *ioc, const struct iovec *iov,
 int multifd_file_recv_data(MultiFDRecvParams *p, Error **errp)
 {
     MultiFDRecvData *data = p->data;
+    unsigned int i;
     size_t ret;
 
-    ret = qio_channel_pread(p->c, (char *) data->opaque,
-                            data->size, data->file_offset, errp);
-    if (ret != data->size) {
-        error_prepend(errp,
-                      "multifd recv (%u): read 0x%zx, expected 0x%zx",
-                      p->id, ret, data->size);
-        return -1;
+    for (i = 0; i < data->num_ranges; i++) {
+        MultiFDRecvRange *range = &data->ranges[i];
+
+        ret = qio_channel_pread(p->c, (char *) range->opaque,
+                                range->size, range->file_offset, errp);
+        if (ret != range->size) {
+            error_prepend(errp,
+                          "multifd recv (%u): read 0x%zx, expected 0x%zx",
+                          p->id, ret, range->size);
+            return -1;
+        }
     }
 
     return 0;
@@ -442,6 +442,20 @@ struct MigrationState {
      */
     uint8_t clear_bitmap_shift;
 
+    /*
+     * Upper bound, in bytes, of the memory that the destination requests
+     * right after a faulting host page when postcopy faults follow a
+     * sequential pattern.  0 disables fault-ahead.
+     */
+    uint64_t postcopy_fault_ahead;
+
+    /*
+     * With the dirty-limit capability, derive a limit for each vCPU from
+     * the migration bandwidth and downtime-limit instead of applying
+     * vcpu-dirty-limit to all of them.
+     */
+    bool vcpu_dirty_limit_auto;
+
     /*
      * This save hostname when out-going migration starts
      */
@@ -493,9 +507,10 @@ void migrate_send_rp_shut(MigrationIncomingState *mis,
 void migrate_send_rp_pong(MigrationIncomingState *mis,
                           uint32_t value);
 int migrate_send_rp_req_pages(MigrationIncomingState *mis, RAMBlock *rb,
-                              ram_addr_t start, uint64_t haddr);
+                              ram_addr_t start, size_t len, uint64_t haddr);
 int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
-                                      RAMBlock *rb, ram_addr_t start);
+                                      RAMBlock *rb, ram_addr_t start,
+                                      size_t len);
 void migrate_send_rp_recv_bitmap(MigrationIncomingState *mis,
                                  char *block_name);
 void migrate_send_rp_resume_ack(MigrationIncomingState *mis, uint32_t value);
@@ -0,0 +1,219 @@
+/*
+ * Multifd LZ4 compression implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <lz4.h>
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "options.h"
+#include "multifd.h"
+
+struct lz4_data {
+    /* compression state, reused for every packet */
+    void *state;
+    /*
+     * For compression: pages gathered from guest memory
+     * For decompression: pages decompressed from the packet
+     */
+    uint8_t *pbuff;
+    uint32_t pbuff_len;
+    /* compressed buffer */
+    uint8_t *zbuff;
+    /* size of compressed buffer */
+    uint32_t zbuff_len;
+};
+
+/* Multifd lz4 compression */
+
+static int multifd_lz4_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct lz4_data *z = g_new0(struct lz4_data, 1);
+
+    z->state = g_try_malloc(LZ4_sizeofState());
+    z->pbuff_len = MULTIFD_PACKET_SIZE;
+    z->pbuff = g_try_malloc(z->pbuff_len);
+    /* This is the maximum size of the compressed buffer */
+    z->zbuff_len = LZ4_compressBound(MULTIFD_PACKET_SIZE);
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->state || !z->pbuff || !z->zbuff) {
+        g_free(z->state);
+        g_free(z->pbuff);
+        g_free(z->zbuff);
+        g_free(z);
+        error_setg(errp, "multifd %u: out of memory for lz4 buffers", p->id);
+        return -1;
+    }
+    p->compress_data = z;
+
+    /* Needs 2 IOVs, one for packet header and one for compressed data */
+    p->iov = g_new0(struct iovec, 2);
+    return 0;
+}
+
+static void multifd_lz4_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct lz4_data *z = p->compress_data;
+
+    g_free(z->state);
+    z->state = NULL;
+    g_free(z->pbuff);
+    z->pbuff = NULL;
+    g_free(z->zbuff);
+    z->zbuff = NULL;
+    g_free(p->compress_data);
+    p->compress_data = NULL;
+
+    g_free(p->iov);
+    p->iov = NULL;
+}
+
+static int multifd_lz4_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDPages_t *pages = &p->data->u.ram;
+    struct lz4_data *z = p->compress_data;
+    uint32_t page_size = multifd_ram_page_size();
+    uint32_t in_size = pages->normal_num * page_size;
+    int ret;
+    uint32_t i;
+
+    if (!multifd_send_prepare_common(p)) {
+        goto out;
+    }
+
+    /*
+     * Compress the whole packet as a single block rather than page by
+     * page: matches can then span pages, and LZ4 runs one long tight
+     * loop over contiguous memory.  The copy also gives the compressor
+     * a stable input, since the guest may keep writing to its pages.
+     */
+    for (i = 0; i < pages->normal_num; i++) {
+        memcpy(z->pbuff + i * page_size,
+               pages->block->host + pages->offset[i], page_size);
+    }
+
+    ret = LZ4_compress_fast_extState(z->state, (const char *)z->pbuff,
+                                     (char *)z->zbuff, in_size,
+                                     z->zbuff_len, 1);
+    if (ret <= 0) {
+        error_setg(errp, "multifd %u: LZ4_compress_fast_extState failed",
+                   p->id);
+        return -1;
+    }
+
+    p->iov[p->iovs_num].iov_base = z->zbuff;
+    p->iov[p->iovs_num].iov_len = ret;
+    p->iovs_num++;
+    p->next_packet_size = ret;
+
+out:
+    p->flags |= MULTIFD_FLAG_LZ4;
+    multifd_send_fill_packet(p);
+    return 0;
+}
+
+static int multifd_lz4_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct lz4_data *z = g_new0(struct lz4_data, 1);
+
+    z->pbuff_len = MULTIFD_PACKET_SIZE;
+    z->pbuff = g_try_malloc(z->pbuff_len);
+    z->zbuff_len = LZ4_compressBound(MULTIFD_PACKET_SIZE);
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->pbuff || !z->zbuff) {
+        g_free(z->pbuff);
+        g_free(z->zbuff);
+        g_free(z);
+        error_setg(errp, "multifd %u: out of memory for lz4 buffers", p->id);
+        return -1;
+    }
+    p->compress_data = z;
+    return 0;
+}
+
+static void multifd_lz4_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct lz4_data *z = p->compress_data;
+
+    g_free(z->pbuff);
+    z->pbuff = NULL;
+    g_free(z->zbuff);
+    z->zbuff = NULL;
+    g_free(p->compress_data);
+    p->compress_data = NULL;
+}
+
+static int multifd_lz4_recv(MultiFDRecvParams *p, Error **errp)
+{
+    uint32_t in_size = p->next_packet_size;
+    uint32_t page_size = multifd_ram_page_size();
+    uint32_t expected_size = p->normal_num * page_size;
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    struct lz4_data *z = p->compress_data;
+    int ret;
+    int i;
+
+    if (flags != MULTIFD_FLAG_LZ4) {
+        error_setg(errp, "multifd %u: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_LZ4);
+        return -1;
+    }
+
+    multifd_recv_zero_page_process(p);
+
+    if (!p->normal_num) {
+        assert(in_size == 0);
+        return 0;
+    }
+
+    if (in_size > z->zbuff_len) {
+        error_setg(errp, "multifd %u: received unexpectedly large packet",
+                   p->id);
+        return -1;
+    }
+
+    ret = qio_channel_read_all(p->c, (void *)z->zbuff, in_size, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    ret = LZ4_decompress_safe((const char *)z->zbuff, (char *)z->pbuff,
+                              in_size, z->pbuff_len);
+    if (ret < 0) {
+        error_setg(errp, "multifd %u: LZ4_decompress_safe returned %d",
+                   p->id, ret);
+        return -1;
+    }
+    if (ret != expected_size) {
+        error_setg(errp, "multifd %u: packet size received %d size expected %u",
+                   p->id, ret, expected_size);
+        return -1;
+    }
+
+    for (i = 0; i < p->normal_num; i++) {
+        ramblock_recv_bitmap_set_offset(p->block, p->normal[i]);
+        memcpy(p->host + p->normal[i], z->pbuff + i * page_size, page_size);
+    }
+    return 0;
+}
+
+static const MultiFDMethods multifd_lz4_ops = {
+    .send_setup = multifd_lz4_send_setup,
+    .send_cleanup = multifd_lz4_send_cleanup,
+    .send_prepare = multifd_lz4_send_prepare,
+    .recv_setup = multifd_lz4_recv_setup,
+    .recv_cleanup = multifd_lz4_recv_cleanup,
+    .recv = multifd_lz4_recv
+};
+
+static void multifd_lz4_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_LZ4, &multifd_lz4_ops);
+}
+
+migration_init(multifd_lz4_register);
@@ -177,7 +177,15 @@ static int multifd_nocomp_recv(MultiFDRecvParams *p, Error **errp)
         p->iov[i].iov_len = multifd_ram_page_size();
         ramblock_recv_bitmap_set_offset(p->block, p->normal[i]);
     }
-    return qio_channel_readv_all(p->c, p->iov, p->normal_num, errp);
+
+    /*
+     * The pages are read straight into guest memory.  Ask the socket
+     * to fill the whole packet at once: otherwise each recvmsg()
+     * returns whatever already arrived, and a packet costs many
+     * syscalls.
+     */
+    return qio_channel_readv_full_all(p->c, p->iov, p->normal_num, NULL, NULL,
+                                      QIO_CHANNEL_READ_FLAG_WAITALL, errp);
 }
 
 static void multifd_pages_reset(MultiFDPages_t *pages)
@@ -1195,6 +1195,7 @@ static void *multifd_recv_thread(void *opaque)
             }
         } else {
             p->data->size = 0;
+            p->data->num_ranges = 0;
             /*
              * Order data->size update before clearing
              * pending_job. Pairs with smp_mb_acquire() at
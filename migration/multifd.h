@@ -45,6 +45,8 @@ MultiFDRecvData *multifd_get_recv_data(void);
 #define MULTIFD_FLAG_QPL (4 << 1)
 #define MULTIFD_FLAG_UADK (8 << 1)
 #define MULTIFD_FLAG_QATZIP (16 << 1)
+/* All the single bits are taken, the remaining methods use other values */
+#define MULTIFD_FLAG_LZ4 (3 << 1)
 
 /* This value needs to be a multiple of qemu_target_page_size() */
 #define MULTIFD_PACKET_SIZE (512 * 1024)
@@ -83,11 +85,21 @@ typedef struct {
     ram_addr_t offset[];
 } MultiFDPages_t;
 
-struct MultiFDRecvData {
+/* Maximum number of file regions read by one mapped-ram job */
+#define MULTIFD_RECV_MAX_RANGES 64
+
+typedef struct {
     void *opaque;
     size_t size;
     /* for preadv */
     off_t file_offset;
+} MultiFDRecvRange;
+
+struct MultiFDRecvData {
+    /* Sum of the range sizes, 0 if there is nothing to do */
+    size_t size;
+    unsigned int num_ranges;
+    MultiFDRecvRange ranges[MULTIFD_RECV_MAX_RANGES];
 };
 
 typedef enum {
@@ -69,6 +69,8 @@
  * that page requests can still exceed this limit.
  */
 #define DEFAULT_MIGRATE_MAX_POSTCOPY_BANDWIDTH 0
+/* Maximum amount of memory requested ahead of a postcopy page fault */
+#define DEFAULT_MIGRATE_POSTCOPY_FAULT_AHEAD (256 << 10)
 
 /*
  * Parameters for self_announce_delay giving a stream of RARP/ARP
@@ -98,6 +100,11 @@ Property migration_properties[] = {
                       clear_bitmap_shift, CLEAR_BITMAP_SHIFT_DEFAULT),
     DEFINE_PROP_BOOL("x-preempt-pre-7-2", MigrationState,
                      preempt_pre_7_2, false),
+    DEFINE_PROP_SIZE("x-postcopy-fault-ahead", MigrationState,
+                     postcopy_fault_ahead,
+                     DEFAULT_MIGRATE_POSTCOPY_FAULT_AHEAD),
+    DEFINE_PROP_BOOL("x-vcpu-dirty-limit-auto", MigrationState,
+                     vcpu_dirty_limit_auto, false),
 
     /* Migration parameters */
     DEFINE_PROP_UINT8("x-throttle-trigger-threshold", MigrationState,
@@ -196,6 +203,8 @@ Property migration_properties[] = {
                         MIGRATION_CAPABILITY_SWITCHOVER_ACK),
     DEFINE_PROP_MIG_CAP("x-dirty-limit", MIGRATION_CAPABILITY_DIRTY_LIMIT),
     DEFINE_PROP_MIG_CAP("mapped-ram", MIGRATION_CAPABILITY_MAPPED_RAM),
+    DEFINE_PROP_MIG_CAP("mapped-ram-incremental",
+                        MIGRATION_CAPABILITY_MAPPED_RAM_INCREMENTAL),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -248,6 +257,13 @@ bool migrate_mapped_ram(void)
     return s->capabilities[MIGRATION_CAPABILITY_MAPPED_RAM];
 }
 
+bool migrate_mapped_ram_incremental(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_MAPPED_RAM_INCREMENTAL];
+}
+
 bool migrate_ignore_shared(void)
 {
     MigrationState *s = migrate_get_current();
@@ -360,6 +376,20 @@ bool migrate_postcopy(void)
     return migrate_postcopy_ram() || migrate_dirty_bitmaps();
 }
 
+uint64_t migrate_postcopy_fault_ahead(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->postcopy_fault_ahead;
+}
+
+bool migrate_vcpu_dirty_limit_auto(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->vcpu_dirty_limit_auto;
+}
+
 bool migrate_rdma(void)
 {
     MigrationState *s = migrate_get_current();
@@ -599,6 +629,20 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
         }
     }
 
+    if (new_caps[MIGRATION_CAPABILITY_MAPPED_RAM_INCREMENTAL]) {
+        if (!new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+            error_setg(errp, "Capability 'mapped-ram-incremental' requires "
+                             "capability 'mapped-ram'");
+            return false;
+        }
+
+        if (new_caps[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT]) {
+            error_setg(errp, "Incremental mapped-ram migration is "
+                             "incompatible with background-snapshot");
+            return false;
+        }
+    }
+
     return true;
 }
 
@@ -643,6 +687,10 @@ void qmp_migrate_set_capabilities(MigrationCapabilityStatusList *params,
     for (cap = params; cap; cap = cap->next) {
         s->capabilities[cap->value->capability] = cap->value->state;
     }
+
+    if (!migrate_mapped_ram_incremental()) {
+        ram_mapped_ram_incremental_stop();
+    }
 }
 
 /* parameters */
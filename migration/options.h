@@ -29,6 +29,7 @@ bool migrate_colo(void);
 bool migrate_dirty_bitmaps(void);
 bool migrate_events(void);
 bool migrate_mapped_ram(void);
+bool migrate_mapped_ram_incremental(void);
 bool migrate_ignore_shared(void);
 bool migrate_late_block_activate(void);
 bool migrate_multifd(void);
@@ -51,8 +52,10 @@ bool migrate_zero_copy_send(void);
 
 bool migrate_multifd_flush_after_each_section(void);
 bool migrate_postcopy(void);
+uint64_t migrate_postcopy_fault_ahead(void);
 bool migrate_rdma(void);
 bool migrate_tls(void);
+bool migrate_vcpu_dirty_limit_auto(void);
 
 /* capabilities helpers */
 
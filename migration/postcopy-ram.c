@@ -753,7 +753,7 @@ int postcopy_wake_shared(struct PostCopyFD *pcfd,
 }
 
 static int postcopy_request_page(MigrationIncomingState *mis, RAMBlock *rb,
-                                 ram_addr_t start, uint64_t haddr)
+                                 ram_addr_t start, size_t len, uint64_t haddr)
 {
     void *aligned = (void *)(uintptr_t)ROUND_DOWN(haddr, qemu_ram_pagesize(rb));
 
@@ -772,7 +772,7 @@ static int postcopy_request_page(MigrationIncomingState *mis, RAMBlock *rb,
         return received ? 0 : postcopy_place_page_zero(mis, aligned, rb);
     }
 
-    return migrate_send_rp_req_pages(mis, rb, start, haddr);
+    return migrate_send_rp_req_pages(mis, rb, start, len, haddr);
 }
 
 /*
@@ -793,7 +793,8 @@ int postcopy_request_shared_page(struct PostCopyFD *pcfd, RAMBlock *rb,
                                         qemu_ram_get_idstr(rb), rb_offset);
         return postcopy_wake_shared(pcfd, client_addr, rb);
     }
-    postcopy_request_page(mis, rb, aligned_rbo, client_addr);
+    postcopy_request_page(mis, rb, aligned_rbo, qemu_ram_pagesize(rb),
+                          client_addr);
     return 0;
 }
 
@@ -823,22 +824,18 @@ static uint32_t get_low_time_offset(PostcopyBlocktimeContext *dc)
  * tracks down vCPU blocking time.
  *
  * @addr: faulted host virtual address
- * @ptid: faulted process thread id
+ * @cpu: index of the faulted vCPU, or -1
  * @rb: ramblock appropriate to addr
  */
-static void mark_postcopy_blocktime_begin(uintptr_t addr, uint32_t ptid,
+static void mark_postcopy_blocktime_begin(uintptr_t addr, int cpu,
                                           RAMBlock *rb)
 {
-    int cpu, already_received;
+    int already_received;
     MigrationIncomingState *mis = migration_incoming_get_current();
     PostcopyBlocktimeContext *dc = mis->blocktime_ctx;
     uint32_t low_time_offset;
 
-    if (!dc || ptid == 0) {
-        return;
-    }
-    cpu = get_mem_fault_cpu_index(ptid);
-    if (cpu < 0) {
+    if (!dc || cpu < 0) {
         return;
     }
 
@@ -943,6 +940,57 @@ static void mark_postcopy_blocktime_end(uintptr_t addr)
                                       affected_cpu);
 }
 
+/*
+ * Fault-ahead: once the faults of a vCPU walk forward through a RAMBlock,
+ * also request the pages that follow the faulting one.  The window doubles
+ * on every fault that lands within or right after the previous window, up
+ * to x-postcopy-fault-ahead bytes, and any other fault closes it again so
+ * that random accesses do not waste bandwidth.  The faulting vCPU is only
+ * known when blocktime tracking is enabled; otherwise all faults share one
+ * state.
+ */
+typedef struct PostcopyFaultAhead {
+    RAMBlock *rb;
+    /* Last faulting host page */
+    ram_addr_t offset;
+    /* Host pages requested after it */
+    unsigned int window;
+} PostcopyFaultAhead;
+
+/* Returns the length to request for the fault on the host page at @offset */
+static size_t postcopy_fault_ahead(PostcopyFaultAhead *fa, RAMBlock *rb,
+                                   ram_addr_t offset)
+{
+    size_t pagesize = qemu_ram_pagesize(rb);
+    unsigned int max = migrate_postcopy_fault_ahead() / pagesize;
+    unsigned int i;
+
+    if (fa->rb == rb && offset > fa->offset &&
+        offset - fa->offset <= (fa->window + 1) * pagesize) {
+        fa->window = MIN(MAX(fa->window * 2, 1), max);
+    } else {
+        fa->window = 0;
+    }
+    fa->rb = rb;
+    fa->offset = offset;
+
+    /* Stop at the first page that we already have or that won't come */
+    for (i = 0; i < fa->window; i++) {
+        ram_addr_t next = offset + (i + 1) * pagesize;
+
+        if (next >= qemu_ram_get_used_length(rb) ||
+            ramblock_recv_bitmap_test_byte_offset(rb, next) ||
+            ramblock_page_is_discarded(rb, next)) {
+            break;
+        }
+    }
+
+    if (i) {
+        trace_postcopy_ram_fault_ahead(qemu_ram_get_idstr(rb), offset, i);
+    }
+    return (i + 1) * pagesize;
+}
+
 static void postcopy_pause_fault_thread(MigrationIncomingState *mis)
 {
     trace_postcopy_pause_fault_thread();
@@ -956,6 +1004,8 @@ static void postcopy_pause_fault_thread(MigrationIncomingState *mis)
 static void *postcopy_ram_fault_thread(void *opaque)
 {
     MigrationIncomingState *mis = opaque;
+    MachineState *ms = MACHINE(qdev_get_machine());
+    PostcopyFaultAhead *fault_ahead;
     struct uffd_msg msg;
     int ret;
     size_t index;
@@ -970,6 +1020,8 @@ static void *postcopy_ram_fault_thread(void *opaque)
     size_t pfd_len = 2 + mis->postcopy_remote_fds->len;
 
     pfd = g_new0(struct pollfd, pfd_len);
+    /* One state per vCPU, plus one for faults of unknown origin */
+    fault_ahead = g_new0(PostcopyFaultAhead, ms->smp.cpus + 1);
 
     pfd[0].fd = mis->userfault_fd;
     pfd[0].events = POLLIN;
@@ -987,7 +1039,9 @@ static void *postcopy_ram_fault_thread(void *opaque)
 
     while (true) {
         ram_addr_t rb_offset;
+        size_t len;
         int poll_result;
+        int cpu;
 
         /*
          * We're mainly waiting for the kernel to give us a faulting HVA,
@@ -1068,16 +1122,22 @@ static void *postcopy_ram_fault_thread(void *opaque)
                                                 qemu_ram_get_idstr(rb),
                                                 rb_offset,
                                                 msg.arg.pagefault.feat.ptid);
+            /* The thread id is only reported for blocktime tracking */
+            cpu = msg.arg.pagefault.feat.ptid ?
+                  get_mem_fault_cpu_index(msg.arg.pagefault.feat.ptid) : -1;
             mark_postcopy_blocktime_begin(
-                    (uintptr_t)(msg.arg.pagefault.address),
-                                msg.arg.pagefault.feat.ptid, rb);
+                    (uintptr_t)(msg.arg.pagefault.address), cpu, rb);
+            if (cpu < 0 || cpu >= ms->smp.cpus) {
+                cpu = ms->smp.cpus;
+            }
+            len = postcopy_fault_ahead(&fault_ahead[cpu], rb, rb_offset);
 
 retry:
             /*
-             * Send the request to the source - we want to request one
-             * of our host page sizes (which is >= TPS)
+             * Send the request to the source - we want to request at least
+             * one of our host page sizes (which is >= TPS)
              */
-            ret = postcopy_request_page(mis, rb, rb_offset,
+            ret = postcopy_request_page(mis, rb, rb_offset, len,
                                         msg.arg.pagefault.address);
             if (ret) {
                 /* May be network failure, try to wait for recovery */
@@ -1144,6 +1204,7 @@ retry:
     }
     rcu_unregister_thread();
     trace_postcopy_ram_fault_thread_exit();
+    g_free(fault_ahead);
     g_free(pfd);
     return NULL;
 }
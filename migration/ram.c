@@ -28,6 +28,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
 #include "qemu/madvise.h"
@@ -51,6 +52,7 @@
 #include "exec/ram_addr.h"
 #include "exec/target_page.h"
 #include "qemu/rcu_queue.h"
+#include "qemu/uuid.h"
 #include "migration/colo.h"
 #include "sysemu/cpu-throttle.h"
 #include "savevm.h"
@@ -370,6 +372,8 @@ struct RAMState {
     uint32_t last_version;
     /* How many times we have dirty too many pages */
     int dirty_rate_high_cnt;
+    /* Total dirty page rate allowed to the guest by dirty-limit, MB/s */
+    uint64_t dirty_limit_budget;
     /* these variables are used for bitmap sync */
     /* last time we did a full bitmap_sync */
     int64_t time_last_bitmap_sync;
@@ -1013,6 +1017,40 @@ static void migration_dirty_limit_guest(void)
     trace_migration_dirty_limit_guest(quota_dirtyrate);
 }
 
+/*
+ * Let dirty-limit throttle only the vCPUs that dirty memory, within a
+ * total dirty page rate that allows migration to converge: what can be
+ * sent in a sync period and, once there, within downtime-limit.  This
+ * is called again each time the guest still dirties too much, so the
+ * budget is scaled down by how far off the last one was.
+ */
+static void migration_dirty_limit_auto(RAMState *rs,
+                                       uint64_t bytes_xfer_period,
+                                       uint64_t bytes_dirty_period,
+                                       uint64_t bytes_dirty_threshold)
+{
+    int64_t period = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) -
+                     rs->time_last_bitmap_sync;
+    uint64_t target, budget;
+
+    if (period <= 0 || !bytes_dirty_period) {
+        return;
+    }
+
+    target = MIN(bytes_dirty_threshold,
+                 bytes_xfer_period * migrate_downtime_limit() / period);
+
+    if (!rs->dirty_limit_budget) {
+        budget = target * 1000 / period / MiB;
+    } else {
+        budget = rs->dirty_limit_budget * target / bytes_dirty_period;
+    }
+    rs->dirty_limit_budget = MAX(budget, 1);
+
+    trace_migration_dirty_limit_auto(rs->dirty_limit_budget);
+    dirtylimit_set_budget(rs->dirty_limit_budget);
+}
+
 static void migration_trigger_throttle(RAMState *rs)
 {
     uint64_t threshold = migrate_throttle_trigger_threshold();
@@ -1036,7 +1074,13 @@ static void migration_trigger_throttle(RAMState *rs)
             mig_throttle_guest_down(bytes_dirty_period,
                                     bytes_dirty_threshold);
         } else if (migrate_dirty_limit()) {
-            migration_dirty_limit_guest();
+            if (migrate_vcpu_dirty_limit_auto()) {
+                migration_dirty_limit_auto(rs, bytes_xfer_period,
+                                           bytes_dirty_period,
+                                           bytes_dirty_threshold);
+            } else {
+                migration_dirty_limit_guest();
+            }
         }
     }
 }
@@ -2768,6 +2812,59 @@ static void migration_bitmap_clear_discarded_pages(RAMState *rs)
     }
 }
 
+/*
+ * Start an incremental mapped-ram migration from the file_bmap of the
+ * previous one.  Only the pages dirtied since then need to be written,
+ * and those are picked up by the first bitmap sync.  Whether the file
+ * still matches the parent is checked later by mapped_ram_check_parent().
+ */
+static void mapped_ram_init_from_parent(RAMState *rs)
+{
+    bool tracking = global_dirty_tracking & GLOBAL_DIRTY_SNAPSHOT;
+    RAMBlock *block;
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+
+        if (migrate_mapped_ram_incremental() && tracking &&
+            block->parent_file_bmap &&
+            block->parent_used_length == block->used_length &&
+            !memory_region_has_ram_discard_manager(block->mr)) {
+            bitmap_copy(block->file_bmap, block->parent_file_bmap, pages);
+            bitmap_zero(block->bmap, block->max_length >> TARGET_PAGE_BITS);
+            rs->migration_dirty_pages -= pages;
+            trace_mapped_ram_init_from_parent(block->idstr, pages);
+        } else {
+            block->parent_pages_offset = 0;
+        }
+
+        /* Only a migration that completes sets up a new parent */
+        g_free(block->parent_file_bmap);
+        block->parent_file_bmap = NULL;
+    }
+}
+
+/*
+ * Called once incremental mapped-ram is disabled: stop the dirty
+ * tracking left running for the next migration and forget the parents.
+ */
+void ram_mapped_ram_incremental_stop(void)
+{
+    RAMBlock *block;
+
+    if (global_dirty_tracking & GLOBAL_DIRTY_SNAPSHOT) {
+        memory_global_dirty_log_stop(GLOBAL_DIRTY_SNAPSHOT);
+    }
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH(block) {
+            g_free(block->parent_file_bmap);
+            block->parent_file_bmap = NULL;
+            block->parent_pages_offset = 0;
+        }
+    }
+}
+
 static bool ram_init_bitmaps(RAMState *rs, Error **errp)
 {
     bool ret = true;
@@ -2776,12 +2873,26 @@ static bool ram_init_bitmaps(RAMState *rs, Error **errp)
 
     WITH_RCU_READ_LOCK_GUARD() {
         ram_list_init_bitmaps();
+        if (migrate_mapped_ram()) {
+            mapped_ram_init_from_parent(rs);
+        }
         /* We don't use dirty log with background snapshots */
         if (!migrate_background_snapshot()) {
             ret = memory_global_dirty_log_start(GLOBAL_DIRTY_MIGRATION, errp);
             if (!ret) {
                 goto out_unlock;
             }
+            if (migrate_mapped_ram_incremental()) {
+                /* Keep tracking after this migration finishes */
+                ret = memory_global_dirty_log_start(GLOBAL_DIRTY_SNAPSHOT,
+                                                    errp);
+                if (!ret) {
+                    memory_global_dirty_log_stop(GLOBAL_DIRTY_MIGRATION);
+                    goto out_unlock;
+                }
+            } else if (global_dirty_tracking & GLOBAL_DIRTY_SNAPSHOT) {
+                memory_global_dirty_log_stop(GLOBAL_DIRTY_SNAPSHOT);
+            }
             migration_bitmap_sync_precopy(rs, false);
         }
     }
@@ -2917,9 +3028,72 @@ struct MappedRamHeader {
      * are stored.
      */
     uint64_t pages_offset;
+    /*
+     * Identifies the incremental mapped-ram migration that wrote this
+     * header.  Only incremental migrations write it, other migrations
+     * produce the same header as before it was added.  Readers only
+     * read the fields above, so this does not need a new version.
+     */
+    uint8_t save_uuid[16];
 } QEMU_PACKED;
 typedef struct MappedRamHeader MappedRamHeader;
 
+/* Size of the header without save_uuid */
+#define MAPPED_RAM_HDR_BASE_SIZE offsetof(MappedRamHeader, save_uuid)
+
+/*
+ * The current incremental mapped-ram migration, and the last one that
+ * completed, whose pages the next one builds upon.
+ */
+static QemuUUID mapped_ram_save_uuid;
+static QemuUUID mapped_ram_parent_uuid;
+
+/*
+ * Check that the header about to be overwritten for @block was written
+ * by the parent migration, i.e. that the file still holds its pages.
+ */
+static bool mapped_ram_parent_in_file(QEMUFile *file, RAMBlock *block)
+{
+    MappedRamHeader header;
+
+    if (!block->parent_pages_offset) {
+        return false;
+    }
+
+    if (qio_channel_pread(qemu_file_get_ioc(file), (char *)&header,
+                          sizeof(header), qemu_get_offset(file),
+                          NULL) != sizeof(header)) {
+        return false;
+    }
+
+    return !memcmp(header.save_uuid, mapped_ram_parent_uuid.data,
+                   sizeof(header.save_uuid));
+}
+
+/*
+ * The pages inherited by mapped_ram_init_from_parent() are only valid
+ * if they are still in the file at the same place.  Otherwise go back
+ * to writing every page of @block.
+ */
+static void mapped_ram_check_parent(RAMState *rs, RAMBlock *block,
+                                    bool in_file)
+{
+    unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+
+    if (!block->parent_pages_offset) {
+        return;
+    }
+
+    if (!in_file || block->parent_pages_offset != block->pages_offset) {
+        trace_mapped_ram_drop_parent(block->idstr);
+        rs->migration_dirty_pages += pages -
+                                     bitmap_count_one(block->bmap, pages);
+        bitmap_set(block->bmap, 0, block->max_length >> TARGET_PAGE_BITS);
+        bitmap_zero(block->file_bmap, pages);
+    }
+    block->parent_pages_offset = 0;
+}
+
 static void mapped_ram_setup_ramblock(QEMUFile *file, RAMBlock *block)
 {
     g_autofree MappedRamHeader *header = NULL;
@@ -2927,7 +3101,8 @@ static void mapped_ram_setup_ramblock(QEMUFile *file, RAMBlock *block)
     long num_pages;
 
     header = g_new0(MappedRamHeader, 1);
-    header_size = sizeof(MappedRamHeader);
+    header_size = migrate_mapped_ram_incremental() ? sizeof(MappedRamHeader) :
+                                                     MAPPED_RAM_HDR_BASE_SIZE;
 
     num_pages = block->used_length >> TARGET_PAGE_BITS;
     bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
@@ -2946,6 +3121,10 @@ static void mapped_ram_setup_ramblock(QEMUFile *file, RAMBlock *block)
     header->page_size = cpu_to_be64(TARGET_PAGE_SIZE);
     header->bitmap_offset = cpu_to_be64(block->bitmap_offset);
     header->pages_offset = cpu_to_be64(block->pages_offset);
+    if (migrate_mapped_ram_incremental()) {
+        memcpy(header->save_uuid, mapped_ram_save_uuid.data,
+               sizeof(header->save_uuid));
+    }
 
     qemu_put_buffer(file, (uint8_t *) header, header_size);
 
@@ -2956,8 +3135,13 @@ static void mapped_ram_setup_ramblock(QEMUFile *file, RAMBlock *block)
 static bool mapped_ram_read_header(QEMUFile *file, MappedRamHeader *header,
                                    Error **errp)
 {
-    size_t ret, header_size = sizeof(MappedRamHeader);
+    size_t ret, header_size = MAPPED_RAM_HDR_BASE_SIZE;
 
+    /*
+     * Not all writers add save_uuid, but the offsets below tell where the
+     * rest of the ramblock is, so there is no need to read it.
+     */
+    memset(header, 0, sizeof(*header));
     ret = qemu_get_buffer(file, (uint8_t *)header, header_size);
     if (ret != header_size) {
         error_setg(errp, "Could not read whole mapped-ram migration header "
@@ -3018,6 +3202,10 @@ static int ram_save_setup(QEMUFile *f, void *opaque, Error **errp)
      */
     max_hg_page_size = MAX(qemu_real_host_page_size(), TARGET_PAGE_SIZE);
 
+    if (migrate_mapped_ram_incremental()) {
+        qemu_uuid_generate(&mapped_ram_save_uuid);
+    }
+
     WITH_RCU_READ_LOCK_GUARD() {
         qemu_put_be64(f, ram_bytes_total_with_ignored()
                          | RAM_SAVE_FLAG_MEM_SIZE);
@@ -3035,7 +3223,10 @@ static int ram_save_setup(QEMUFile *f, void *opaque, Error **errp)
             }
 
             if (migrate_mapped_ram()) {
+                bool in_file = mapped_ram_parent_in_file(f, block);
+
                 mapped_ram_setup_ramblock(f, block);
+                mapped_ram_check_parent(*rsp, block, in_file);
             }
         }
     }
@@ -3087,6 +3278,11 @@ static int ram_save_setup(QEMUFile *f, void *opaque, Error **errp)
 static void ram_save_file_bmap(QEMUFile *f)
 {
     RAMBlock *block;
+    bool keep_parent = migrate_mapped_ram_incremental();
+
+    if (keep_parent) {
+        mapped_ram_parent_uuid = mapped_ram_save_uuid;
+    }
 
     RAMBLOCK_FOREACH_MIGRATABLE(block) {
         long num_pages = block->used_length >> TARGET_PAGE_BITS;
@@ -3099,9 +3295,16 @@ static void ram_save_file_bmap(QEMUFile *f)
         /*
          * Free the bitmap here to catch any synchronization issues
          * with multifd channels. No channels should be sending pages
-         * after we've written the bitmap to file.
+         * after we've written the bitmap to file.  With incremental
+         * mapped-ram it becomes the parent of the next migration.
          */
-        g_free(block->file_bmap);
+        if (keep_parent && !qemu_file_get_error(f)) {
+            block->parent_file_bmap = block->file_bmap;
+            block->parent_pages_offset = block->pages_offset;
+            block->parent_used_length = block->used_length;
+        } else {
+            g_free(block->file_bmap);
+        }
         block->file_bmap = NULL;
     }
 }
@@ -3890,22 +4093,40 @@ void colo_flush_ram_cache(void)
     trace_colo_flush_ram_cache_end();
 }
 
+/*
+ * Add the file region of @size bytes at @offset to the multifd job being
+ * filled, and hand the job to a channel once it is full.  With a fragmented
+ * bitmap this avoids waking up a channel for every short run of pages.
+ */
 static size_t ram_load_multifd_pages(void *host_addr, size_t size,
                                      uint64_t offset)
 {
     MultiFDRecvData *data = multifd_get_recv_data();
+    MultiFDRecvRange *range = &data->ranges[data->num_ranges++];
 
-    data->opaque = host_addr;
-    data->file_offset = offset;
-    data->size = size;
+    range->opaque = host_addr;
+    range->file_offset = offset;
+    range->size = size;
+    data->size += size;
 
-    if (!multifd_recv()) {
-        return 0;
+    if (data->num_ranges == MULTIFD_RECV_MAX_RANGES ||
+        data->size >= MAPPED_RAM_LOAD_BUF_SIZE) {
+        if (!multifd_recv()) {
+            return 0;
+        }
     }
 
     return size;
 }
 
+/* Hand the partially filled multifd job to a channel */
+static bool ram_load_multifd_flush(void)
+{
+    MultiFDRecvData *data = multifd_get_recv_data();
+
+    return !data->size || multifd_recv();
+}
+
 static bool read_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
                                      long num_pages, unsigned long *bitmap,
                                      Error **errp)
@@ -3951,6 +4172,11 @@ static bool read_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
         }
     }
 
+    if (migrate_multifd() && !ram_load_multifd_flush()) {
+        error_setg(errp, "(%s) failed to load the last pages", block->idstr);
+        return false;
+    }
+
     return true;
 
 err:
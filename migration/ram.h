@@ -92,5 +92,6 @@ bool ram_write_tracking_compatible(void);
 void ram_write_tracking_prepare(void);
 int ram_write_tracking_start(void);
 void ram_write_tracking_stop(void);
+void ram_mapped_ram_incremental_stop(void);
 
 #endif
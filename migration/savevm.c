@@ -228,6 +228,8 @@ typedef struct SaveState {
     uint32_t caps_count;
     MigrationCapability *capabilities;
     QemuUUID uuid;
+    /* Entry after the last one loaded, see find_se_for_load() */
+    SaveStateEntry *load_next;
 } SaveState;
 
 static SaveState savevm_state = {
@@ -763,6 +765,9 @@ static void savevm_state_handler_remove(SaveStateEntry *se)
         }
     }
     QTAILQ_REMOVE(&savevm_state.handlers, se, entry);
+    if (savevm_state.load_next == se) {
+        savevm_state.load_next = NULL;
+    }
 }
 
 /* TODO: Individual devices generally have very little idea about the rest
@@ -1813,6 +1818,27 @@ static SaveStateEntry *find_se(const char *idstr, uint32_t instance_id)
     return NULL;
 }
 
+/*
+ * A stream lists its sections in the order of the handlers on the source,
+ * which is also our order when the configuration matches.  Try the entry
+ * that follows the previously loaded section before scanning the list, so
+ * that loading the device state does not take quadratic time in the number
+ * of devices.
+ */
+static SaveStateEntry *find_se_for_load(const char *idstr,
+                                        uint32_t instance_id)
+{
+    SaveStateEntry *se = savevm_state.load_next;
+
+    if (!se || se->instance_id != instance_id || strcmp(se->idstr, idstr)) {
+        se = find_se(idstr, instance_id);
+    }
+    if (se) {
+        savevm_state.load_next = QTAILQ_NEXT(se, entry);
+    }
+    return se;
+}
+
 enum LoadVMExitCodes {
     /* Allow a command to quit all layers of nested loadvm loops */
     LOADVM_QUIT     =  1,
@@ -2225,7 +2251,8 @@ static gboolean postcopy_sync_page_req(gpointer key, gpointer value,
         return FALSE;
     }
 
-    ret = migrate_send_rp_message_req_pages(mis, rb, rb_offset);
+    ret = migrate_send_rp_message_req_pages(mis, rb, rb_offset,
+                                            qemu_ram_pagesize(rb));
     if (ret) {
         /* Please refer to above comment. */
         error_report("%s: send rp message failed for addr %p",
@@ -2607,7 +2634,7 @@ qemu_loadvm_section_start_full(QEMUFile *f, uint8_t type)
     trace_qemu_loadvm_state_section_startfull(section_id, idstr,
             instance_id, version_id);
     /* Find savevm section */
-    se = find_se(idstr, instance_id);
+    se = find_se_for_load(idstr, instance_id);
     if (se == NULL) {
         error_report("Unknown savevm section or instance '%s' %"PRIu32". "
                      "Make sure that your current VM setup matches your "
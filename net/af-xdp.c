@@ -52,6 +52,7 @@ typedef struct AFXDPState {
     uint32_t             n_queues;
     uint32_t             xdp_flags;
     bool                 inhibit;
+    bool                 busy_poll;
 } AFXDPState;
 
 #define AF_XDP_BATCH_SIZE 64
@@ -139,10 +140,11 @@ static void af_xdp_writable(void *opaque)
     qemu_flush_queued_packets(&s->nc);
 }
 
-static ssize_t af_xdp_receive(NetClientState *nc,
-                              const uint8_t *buf, size_t size)
+static ssize_t af_xdp_receive_iov(NetClientState *nc,
+                                  const struct iovec *iov, int iovcnt)
 {
     AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+    size_t size = iov_size(iov, iovcnt);
     struct xdp_desc *desc;
     uint32_t idx;
     void *data;
@@ -168,8 +170,9 @@ static ssize_t af_xdp_receive(NetClientState *nc,
     desc->addr = s->pool[--s->n_pool];
     desc->len = size;
 
+    /* Gather the packet straight into the UMEM frame. */
     data = xsk_umem__get_data(s->buffer, desc->addr);
-    memcpy(data, buf, size);
+    iov_to_buf(iov, iovcnt, 0, data, size);
 
     xsk_ring_prod__submit(&s->tx, 1);
     s->outstanding_tx++;
@@ -181,6 +184,17 @@ static ssize_t af_xdp_receive(NetClientState *nc,
     return size;
 }
 
+static ssize_t af_xdp_receive(NetClientState *nc,
+                              const uint8_t *buf, size_t size)
+{
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size,
+    };
+
+    return af_xdp_receive_iov(nc, &iov, 1);
+}
+
 /*
  * Complete a previous send (backend --> guest) and enable the
  * fd_read callback.
@@ -213,6 +227,15 @@ static void af_xdp_fq_refill(AFXDPState *s, uint32_t n)
     if (xsk_ring_prod__needs_wakeup(&s->fq)) {
         /* Receive was blocked by not having enough buffers.  Wake it up. */
         af_xdp_read_poll(s, true);
+
+        /*
+         * With busy polling the kernel doesn't run NAPI on its own, so kick
+         * it right away instead of waiting for the next poll().
+         */
+        if (s->busy_poll) {
+            recvfrom(xsk_socket__fd(s->xsk), NULL, 0, MSG_DONTWAIT,
+                     NULL, NULL);
+        }
     }
 }
 
@@ -393,6 +416,31 @@ static int af_xdp_socket_create(AFXDPState *s,
 
     s->xdp_flags = cfg.xdp_flags;
 
+    if (opts->has_busy_poll && opts->busy_poll > 0) {
+#ifdef SO_PREFER_BUSY_POLL
+        int fd = xsk_socket__fd(s->xsk);
+        int timeout = opts->busy_poll;
+        int budget = AF_XDP_BATCH_SIZE;
+        int prefer = 1;
+
+        if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL,
+                       &prefer, sizeof(prefer)) ||
+            setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL,
+                       &timeout, sizeof(timeout)) ||
+            setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET,
+                       &budget, sizeof(budget))) {
+            error_setg_errno(errp, errno,
+                             "failed to enable busy polling for %s "
+                             "queue_id: %d", s->ifname, queue_id);
+            return -1;
+        }
+        s->busy_poll = true;
+#else
+        error_setg(errp, "busy polling is not supported on this host");
+        return -1;
+#endif
+    }
+
     return 0;
 }
 
@@ -401,6 +449,7 @@ static NetClientInfo net_af_xdp_info = {
     .type = NET_CLIENT_DRIVER_AF_XDP,
     .size = sizeof(AFXDPState),
     .receive = af_xdp_receive,
+    .receive_iov = af_xdp_receive_iov,
     .poll = af_xdp_poll,
     .cleanup = af_xdp_cleanup,
 };
@@ -465,6 +514,13 @@ int net_init_af_xdp(const Netdev *netdev,
         return -1;
     }
 
+    if (opts->has_busy_poll &&
+        (opts->busy_poll < 0 || opts->busy_poll > INT_MAX)) {
+        error_setg(errp, "invalid busy-poll timeout (%" PRIi64 ") for '%s'",
+                   opts->busy_poll, opts->ifname);
+        return -1;
+    }
+
     if ((opts->has_inhibit && opts->inhibit) != !!opts->sock_fds) {
         error_setg(errp, "'inhibit=on' requires 'sock-fds' and vice versa");
         return -1;
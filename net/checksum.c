@@ -21,22 +21,39 @@
 
 uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
 {
-    uint32_t sum1 = 0, sum2 = 0;
+    uint64_t sum64 = 0;
+    uint32_t sum;
     int i;
 
-    for (i = 0; i < len - 1; i += 2) {
-        sum1 += (uint32_t)buf[i];
-        sum2 += (uint32_t)buf[i + 1];
+    /*
+     * The ones' complement sum does not depend on byte order (RFC 1071),
+     * so add up the bulk of the data in host order, eight bytes at a time,
+     * and only swap the folded result into network order.
+     */
+    for (i = 0; i + 8 <= len; i += 8) {
+        uint64_t w = ldq_he_p(buf + i);
+        sum64 += (w & 0xffffffff) + (w >> 32);
+    }
+    while (sum64 >> 16) {
+        sum64 = (sum64 & 0xffff) + (sum64 >> 16);
+    }
+    sum = be16_to_cpu(sum64);
+
+    for (; i < len - 1; i += 2) {
+        sum += (buf[i] << 8) | buf[i + 1];
     }
     if (i < len) {
-        sum1 += (uint32_t)buf[i];
+        sum += buf[i] << 8;
     }
 
+    /* Data starting at an odd offset contributes byte-swapped words */
     if (seq & 1) {
-        return sum1 + (sum2 << 8);
-    } else {
-        return sum2 + (sum1 << 8);
+        while (sum >> 16) {
+            sum = (sum & 0xffff) + (sum >> 16);
+        }
+        sum = bswap16(sum);
     }
+    return sum;
 }
 
 uint16_t net_checksum_finish(uint32_t sum)
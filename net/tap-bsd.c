@@ -255,3 +255,9 @@ int tap_fd_set_steering_ebpf(int fd, int prog_fd)
 {
     return -1;
 }
+
+int tap_fd_set_rx_filter(int fd, const uint8_t *macs, int count,
+                         bool allmulti)
+{
+    return -1;
+}
@@ -330,3 +330,26 @@ int tap_fd_set_steering_ebpf(int fd, int prog_fd)
 
     return 0;
 }
+
+/*
+ * Only let packets for the @count destination MACs in @macs (plus all
+ * multicast with @allmulti) through to the tap reader.  With no addresses
+ * the kernel disables the filter.  Unicast addresses must come first; the
+ * kernel matches the first few addresses exactly and hashes the rest.
+ */
+int tap_fd_set_rx_filter(int fd, const uint8_t *macs, int count,
+                         bool allmulti)
+{
+    g_autofree struct tun_filter *filter = NULL;
+
+    filter = g_malloc0(sizeof(*filter) + count * sizeof(filter->addr[0]));
+    filter->flags = allmulti ? TUN_FLT_ALLMULTI : 0;
+    filter->count = count;
+    memcpy(filter->addr, macs, count * sizeof(filter->addr[0]));
+
+    if (ioctl(fd, TUNSETTXFILTER, filter) < 0) {
+        return -errno;
+    }
+
+    return 0;
+}
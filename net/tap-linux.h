@@ -24,6 +24,7 @@
 #define TUNSETIFF     _IOW('T', 202, int)
 #define TUNGETFEATURES _IOR('T', 207, unsigned int)
 #define TUNSETOFFLOAD  _IOW('T', 208, unsigned int)
+#define TUNSETTXFILTER _IOW('T', 209, unsigned int)
 #define TUNGETIFF      _IOR('T', 210, unsigned int)
 #define TUNSETSNDBUF   _IOW('T', 212, int)
 #define TUNGETVNETHDRSZ _IOR('T', 215, int)
@@ -53,4 +54,13 @@
 #define TUN_F_USO4    0x20    /* I can handle USO for IPv4 packets */
 #define TUN_F_USO6    0x40    /* I can handle USO for IPv6 packets */
 
+/* TUNSETTXFILTER filter flags and argument */
+#define TUN_FLT_ALLMULTI 0x0001 /* Accept all multicast packets */
+
+struct tun_filter {
+    uint16_t flags;
+    uint16_t count;
+    uint8_t addr[][6];
+};
+
 #endif /* QEMU_TAP_LINUX_H */
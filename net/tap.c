@@ -39,6 +39,7 @@
 #include "sysemu/sysemu.h"
 #include "qapi/error.h"
 #include "qemu/cutils.h"
+#include "qemu/defer-call.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "qemu/sockets.h"
@@ -162,6 +163,9 @@ static void tap_send(void *opaque)
     int size;
     int packets = 0;
 
+    /* Let the peer coalesce its guest notifications for the whole burst */
+    defer_call_begin();
+
     while (true) {
         uint8_t *buf = s->buf;
         uint8_t min_pkt[ETH_ZLEN];
@@ -203,6 +207,8 @@ static void tap_send(void *opaque)
             break;
         }
     }
+
+    defer_call_end();
 }
 
 static bool tap_has_ufo(NetClientState *nc)
@@ -322,6 +328,15 @@ static bool tap_set_steering_ebpf(NetClientState *nc, int prog_fd)
     return tap_fd_set_steering_ebpf(s->fd, prog_fd) == 0;
 }
 
+static bool tap_set_rx_filter(NetClientState *nc, const uint8_t *macs,
+                              int count, bool allmulti)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+    assert(nc->info->type == NET_CLIENT_DRIVER_TAP);
+
+    return tap_fd_set_rx_filter(s->fd, macs, count, allmulti) == 0;
+}
+
 int tap_get_fd(NetClientState *nc)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
@@ -347,6 +362,7 @@ static NetClientInfo net_tap_info = {
     .set_vnet_le = tap_set_vnet_le,
     .set_vnet_be = tap_set_vnet_be,
     .set_steering_ebpf = tap_set_steering_ebpf,
+    .set_rx_filter = tap_set_rx_filter,
 };
 
 static TAPState *net_tap_fd_init(NetClientState *peer,
@@ -441,6 +441,79 @@ static void dirtylimit_cleanup(void)
     dirtylimit_state_finalize();
 }
 
+typedef struct DirtyLimitVcpuRate {
+    int cpu_index;
+    int64_t rate;
+} DirtyLimitVcpuRate;
+
+static int dirtylimit_vcpu_rate_cmp(const void *a, const void *b)
+{
+    const DirtyLimitVcpuRate *ra = a, *rb = b;
+
+    return ra->rate < rb->rate ? -1 : ra->rate > rb->rate;
+}
+
+/*
+ * Share a total dirty page rate @budget (MB/s) among the vCPUs.  vCPUs
+ * dirtying less than an even share of what is left are not limited,
+ * and the rate they do not use is split among the others, so only the
+ * vCPUs that actually dirty memory get throttled.  Until dirty rates
+ * have been measured, every vCPU gets an even share.
+ */
+void dirtylimit_set_budget(uint64_t budget)
+{
+    g_autofree DirtyLimitVcpuRate *rates = NULL;
+    uint64_t left = budget, quota = 0;
+    bool measured = true;
+    CPUState *cpu;
+    int i, n = 0;
+
+    if (!kvm_enabled() || !kvm_dirty_ring_enabled()) {
+        return;
+    }
+
+    dirtylimit_state_lock();
+
+    if (!dirtylimit_in_service()) {
+        dirtylimit_init();
+        measured = false;
+    }
+
+    /*
+     * Idle vCPUs are kept in the list rather than checked for being
+     * stopped: their low dirty rate leaves them unlimited anyway.
+     */
+    rates = g_new(DirtyLimitVcpuRate, dirtylimit_state->max_cpus);
+    CPU_FOREACH(cpu) {
+        rates[n].cpu_index = cpu->cpu_index;
+        rates[n].rate = vcpu_dirty_rate_get(cpu->cpu_index);
+        n++;
+    }
+
+    if (!measured) {
+        quota = MAX(budget / n, 1);
+    }
+
+    qsort(rates, n, sizeof(*rates), dirtylimit_vcpu_rate_cmp);
+
+    for (i = 0; i < n; i++) {
+        if (!quota) {
+            uint64_t share = left / (n - i);
+
+            if (rates[i].rate <= share) {
+                left -= rates[i].rate;
+                dirtylimit_set_vcpu(rates[i].cpu_index, 0, false);
+                continue;
+            }
+            quota = MAX(share, 1);
+        }
+        dirtylimit_set_vcpu(rates[i].cpu_index, quota, true);
+    }
+
+    trace_dirtylimit_set_budget(budget, quota, dirtylimit_state->limited_nvcpu);
+    dirtylimit_state_unlock();
+}
+
 /*
  * dirty page rate limit is not allowed to set if migration
  * is running with dirty-limit capability enabled.
@@ -2142,6 +2142,7 @@ static void reclaim_ramblock(RAMBlock *block)
         ram_block_discard_require(false);
     }
 
+    g_free(block->parent_file_bmap);
     g_free(block);
 }
 
@@ -158,4 +158,41 @@ def __init__(self, name, scenarios):
         Scenario("compr-dirty-limit-50MB",
                  dirty_limit=True, vcpu_dirty_limit=50),
     ]),
+
+
+    # Looking at effect of the multifd compression methods
+    Comparison("compr-multifd-method", scenarios = [
+        Scenario("compr-multifd-method-none",
+                 multifd=True, multifd_compression="none"),
+        Scenario("compr-multifd-method-zlib",
+                 multifd=True, multifd_compression="zlib"),
+        Scenario("compr-multifd-method-zstd",
+                 multifd=True, multifd_compression="zstd"),
+        Scenario("compr-multifd-method-lz4",
+                 multifd=True, multifd_compression="lz4"),
+    ]),
+
+
+    # Looking at effect of the size of the guest working set
+    Comparison("dirty-percent", scenarios = [
+        Scenario("dirty-percent-10",
+                 multifd=True, dirty_percent=10),
+        Scenario("dirty-percent-25",
+                 multifd=True, dirty_percent=25),
+        Scenario("dirty-percent-50",
+                 multifd=True, dirty_percent=50),
+        Scenario("dirty-percent-100",
+                 multifd=True, dirty_percent=100),
+    ]),
+
+
+    # Looking at effect of the guest dirty rate
+    Comparison("dirty-rate", scenarios = [
+        Scenario("dirty-rate-100MB",
+                 multifd=True, dirty_rate=100),
+        Scenario("dirty-rate-500MB",
+                 multifd=True, dirty_rate=500),
+        Scenario("dirty-rate-1000MB",
+                 multifd=True, dirty_rate=1000),
+    ]),
 ]
@@ -41,7 +41,7 @@ def __init__(self, binary, dst_host, kernel, initrd, transport="tcp",
         self._dst_host = dst_host # Hostname of target host
         self._kernel = kernel # Path to kernel image
         self._initrd = initrd # Path to stress initrd
-        self._transport = transport # 'unix' or 'tcp' or 'rdma'
+        self._transport = transport # 'unix', 'tcp', 'rdma' or 'file'
         self._sleep = sleep
         self._verbose = verbose
         self._debug = debug
@@ -129,6 +129,11 @@ def _migrate(self, hardware, scenario, src, dst, connect_uri):
 
         if self._verbose:
             print("Starting migration")
+        if self._transport == "file" and scenario._post_copy:
+            raise Exception("post-copy cannot be used with the file transport")
+        if scenario._mapped_ram and self._transport != "file":
+            raise Exception("mapped-ram needs the file transport")
+
         if scenario._auto_converge:
             resp = src.cmd("migrate-set-capabilities",
                            capabilities = [
@@ -204,6 +209,22 @@ def _migrate(self, hardware, scenario, src, dst, connect_uri):
                            ])
             resp = dst.cmd("migrate-set-parameters",
                            multifd_channels=scenario._multifd_channels)
+            resp = src.cmd("migrate-set-parameters",
+                           multifd_compression=scenario._multifd_compression)
+            resp = dst.cmd("migrate-set-parameters",
+                           multifd_compression=scenario._multifd_compression)
+
+        if scenario._mapped_ram:
+            resp = src.cmd("migrate-set-capabilities",
+                           capabilities = [
+                               { "capability": "mapped-ram",
+                                 "state": True }
+                           ])
+            resp = dst.cmd("migrate-set-capabilities",
+                           capabilities = [
+                               { "capability": "mapped-ram",
+                                 "state": True }
+                           ])
 
         if scenario._dirty_limit:
             if not hardware._dirty_ring_size:
@@ -220,6 +241,8 @@ def _migrate(self, hardware, scenario, src, dst, connect_uri):
             resp = src.cmd("migrate-set-parameters",
                            vcpu_dirty_limit=scenario._vcpu_dirty_limit)
 
+        src_qemu_time.append(self._cpu_timing(src_pid))
+        src_vcpu_time.extend(self._vcpu_timing(src_pid, src_threads))
         resp = src.cmd("migrate", uri=connect_uri)
 
         post_copy = False
@@ -244,6 +267,12 @@ def _migrate(self, hardware, scenario, src, dst, connect_uri):
                 progress_history.append(progress)
 
             if progress._status in ("completed", "failed", "cancelled"):
+                src_qemu_time.append(self._cpu_timing(src_pid))
+                src_vcpu_time.extend(self._vcpu_timing(src_pid, src_threads))
+
+                restore_time = None
+                if progress._status == "completed" and self._transport == "file":
+                    restore_time = self._restore(dst, connect_uri)
                 if progress._status == "completed" and paused:
                     dst.cmd("cont")
                 if progress_history[-1] != progress:
@@ -259,7 +288,8 @@ def _migrate(self, hardware, scenario, src, dst, connect_uri):
                         src_vcpu_time.extend(self._vcpu_timing(src_pid, src_threads))
                         sleep_secs -= 1
 
-                return [progress_history, src_qemu_time, src_vcpu_time]
+                return [progress_history, src_qemu_time, src_vcpu_time,
+                        restore_time]
 
             if self._verbose and (loop % 20) == 0:
                 print("Iter %d: remain %5dMB of %5dMB (total %5dMB @ %5dMb/sec)" % (
@@ -298,6 +328,21 @@ def _migrate(self, hardware, scenario, src, dst, connect_uri):
                 resp = src.cmd("stop")
                 paused = True
 
+    def _restore(self, dst, uri):
+        # With the file transport the destination only starts loading
+        # once the source is done saving.
+        if self._verbose:
+            print("Loading migration file")
+        start = time.time()
+        dst.cmd("migrate-incoming", uri=uri)
+        while True:
+            time.sleep(0.05)
+            status = dst.cmd("query-migrate").get("status", "active")
+            if status == "completed":
+                return (time.time() - start) * 1000
+            if status == "failed":
+                raise Exception("Failed to load the migration file")
+
     def _is_ppc64le(self):
         _, _, _, _, machine = os.uname()
         if machine == "ppc64le":
@@ -318,7 +363,7 @@ def _get_qemu_serial_args(self):
             return ["-chardev", "stdio,id=cdev0",
                     "-device", "isa-serial,chardev=cdev0"]
 
-    def _get_common_args(self, hardware, tunnelled=False):
+    def _get_common_args(self, hardware, scenario, tunnelled=False):
         args = [
             "noapic",
             "edd=off",
@@ -336,6 +381,8 @@ def _get_common_args(self, hardware, tunnelled=False):
             args.append("quiet")
 
         args.append("ramsize=%s" % hardware._mem)
+        args.append("dirtypct=%s" % scenario._dirty_percent)
+        args.append("dirtyrate=%s" % scenario._dirty_rate)
 
         cmdline = " ".join(args)
         if tunnelled:
@@ -370,14 +417,17 @@ def _get_common_args(self, hardware, tunnelled=False):
 
         return argv
 
-    def _get_src_args(self, hardware):
-        return self._get_common_args(hardware)
+    def _get_src_args(self, hardware, scenario):
+        return self._get_common_args(hardware, scenario)
 
-    def _get_dst_args(self, hardware, uri):
+    def _get_dst_args(self, hardware, scenario, uri):
         tunnelled = False
         if self._dst_host != "localhost":
             tunnelled = True
-        argv = self._get_common_args(hardware, tunnelled)
+        argv = self._get_common_args(hardware, scenario, tunnelled)
+        if self._transport == "file":
+            # The file can only be loaded once the source has written it
+            uri = "defer"
         return argv + ["-incoming", uri]
 
     @staticmethod
@@ -438,6 +488,10 @@ def run(self, hardware, scenario, result_dir=os.getcwd()):
                 os.remove(monaddr)
             except:
                 pass
+        elif self._transport == "file":
+            if self._dst_host != "localhost":
+                raise Exception("Running use file migration transport for non-local host")
+            uri = "file:/var/tmp/qemu-migrate-%d.migrate" % os.getpid()
 
         if self._dst_host != "localhost":
             dstmonaddr = ("localhost", 9001)
@@ -446,13 +500,13 @@ def run(self, hardware, scenario, result_dir=os.getcwd()):
         srcmonaddr = "/var/tmp/qemu-src-%d-monitor.sock" % os.getpid()
 
         src = QEMUMachine(self._binary,
-                          args=self._get_src_args(hardware),
+                          args=self._get_src_args(hardware, scenario),
                           wrapper=self._get_src_wrapper(hardware),
                           name="qemu-src-%d" % os.getpid(),
                           monitor_address=srcmonaddr)
 
         dst = QEMUMachine(self._binary,
-                          args=self._get_dst_args(hardware, uri),
+                          args=self._get_dst_args(hardware, scenario, uri),
                           wrapper=self._get_dst_wrapper(hardware),
                           name="qemu-dst-%d" % os.getpid(),
                           monitor_address=dstmonaddr)
@@ -465,8 +519,11 @@ def run(self, hardware, scenario, result_dir=os.getcwd()):
             progress_history = ret[0]
             qemu_timings = ret[1]
             vcpu_timings = ret[2]
+            restore_time = ret[3]
             if uri[0:5] == "unix:" and os.path.exists(uri[5:]):
                 os.remove(uri[5:])
+            if uri[0:5] == "file:" and os.path.exists(uri[5:]):
+                os.remove(uri[5:])
 
             if os.path.exists(srcmonaddr):
                 os.remove(srcmonaddr)
@@ -485,7 +542,8 @@ def run(self, hardware, scenario, result_dir=os.getcwd()):
                           Timings(qemu_timings),
                           Timings(vcpu_timings),
                           self._binary, self._dst_host, self._kernel,
-                          self._initrd, self._transport, self._sleep)
+                          self._initrd, self._transport, self._sleep,
+                          restore_time)
         except Exception as e:
             if self._debug:
                 print("Failed: %s" % str(e))
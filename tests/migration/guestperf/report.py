@@ -38,7 +38,8 @@ def __init__(self,
                  kernel,
                  initrd,
                  transport,
-                 sleep):
+                 sleep,
+                 restore_time=None):
 
         self._hardware = hardware
         self._scenario = scenario
@@ -52,6 +53,57 @@ def __init__(self,
         self._initrd = initrd
         self._transport = transport
         self._sleep = sleep
+        self._restore_time = restore_time # milliseconds, file transport only
+
+    def _cpu_time(self, timings, start, end):
+        # CPU milliseconds used by each thread between start and end
+        first = {}
+        last = {}
+        for record in timings._records:
+            if record._timestamp < start or record._timestamp > end:
+                continue
+            if record._tid not in first:
+                first[record._tid] = record._value
+            last[record._tid] = record._value
+        return sum(last[tid] - first[tid] for tid in first)
+
+    def summary(self):
+        if len(self._progress_history) == 0:
+            return {}
+
+        first = self._progress_history[0]
+        final = self._progress_history[-1]
+        start = first._now - (first._duration / 1000.0)
+        end = final._now
+
+        # The QEMU process time includes the vCPU threads, which are
+        # running the guest workload and not the migration
+        qemu_cpu = self._cpu_time(self._qemu_timings, start, end)
+        vcpu_cpu = self._cpu_time(self._vcpu_timings, start, end)
+        migration_cpu = max(qemu_cpu - vcpu_cpu, 0)
+
+        pages = final._ram._normal_pages + final._ram._duplicate_pages
+        transferred_gb = final._ram._transferred_bytes / (1024.0 ** 3)
+
+        summary = {
+            "status": final._status,
+            "convergence_time_ms": final._duration,
+            "downtime_ms": final._downtime,
+            "setup_time_ms": final._setup_time,
+            "iterations": final._ram._iterations,
+            "transferred_bytes": final._ram._transferred_bytes,
+            "pages": pages,
+            "pages_per_sec": 0,
+            "cpu_ms": migration_cpu,
+            "cpu_ms_per_gb": 0,
+        }
+        if final._duration:
+            summary["pages_per_sec"] = pages * 1000.0 / final._duration
+        if transferred_gb:
+            summary["cpu_ms_per_gb"] = migration_cpu / transferred_gb
+        if self._restore_time is not None:
+            summary["restore_time_ms"] = self._restore_time
+        return summary
 
     def serialize(self):
         return {
@@ -67,6 +119,8 @@ def serialize(self):
             "initrd": self._initrd,
             "transport": self._transport,
             "sleep": self._sleep,
+            "restore_time": self._restore_time,
+            "summary": self.summary(),
         }
 
     @classmethod
@@ -83,11 +137,19 @@ def deserialize(cls, data):
             data["kernel"],
             data["initrd"],
             data["transport"],
-            data["sleep"])
+            data["sleep"],
+            data.get("restore_time"))
 
     def to_json(self):
         return json.dumps(self.serialize(), indent=4)
 
+    def summary_to_json(self):
+        return json.dumps({
+            "scenario": self._scenario.serialize(),
+            "transport": self._transport,
+            "summary": self.summary(),
+        }, indent=4)
+
     @classmethod
     def from_json(cls, data):
         return cls.deserialize(json.loads(data))
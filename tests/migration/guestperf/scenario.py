@@ -31,8 +31,11 @@ def __init__(self, name,
                  compression_mt=False, compression_mt_threads=1,
                  compression_xbzrle=False, compression_xbzrle_cache=10,
                  multifd=False, multifd_channels=2,
+                 multifd_compression="none",
+                 mapped_ram=False,
                  dirty_limit=False, x_vcpu_dirty_limit_period=500,
-                 vcpu_dirty_limit=1):
+                 vcpu_dirty_limit=1,
+                 dirty_percent=100, dirty_rate=0):
 
         self._name = name
 
@@ -61,11 +64,18 @@ def __init__(self, name,
 
         self._multifd = multifd
         self._multifd_channels = multifd_channels
+        self._multifd_compression = multifd_compression
+
+        self._mapped_ram = mapped_ram # needs the 'file' transport
 
         self._dirty_limit = dirty_limit
         self._x_vcpu_dirty_limit_period = x_vcpu_dirty_limit_period
         self._vcpu_dirty_limit = vcpu_dirty_limit
 
+        # Guest workload
+        self._dirty_percent = dirty_percent # percentage of guest RAM
+        self._dirty_rate = dirty_rate # MiB per second per vCPU, 0 = no limit
+
     def serialize(self):
         return {
             "name": self._name,
@@ -85,9 +95,13 @@ def serialize(self):
             "compression_xbzrle_cache": self._compression_xbzrle_cache,
             "multifd": self._multifd,
             "multifd_channels": self._multifd_channels,
+            "multifd_compression": self._multifd_compression,
+            "mapped_ram": self._mapped_ram,
             "dirty_limit": self._dirty_limit,
             "x_vcpu_dirty_limit_period": self._x_vcpu_dirty_limit_period,
             "vcpu_dirty_limit": self._vcpu_dirty_limit,
+            "dirty_percent": self._dirty_percent,
+            "dirty_rate": self._dirty_rate,
         }
 
     @classmethod
@@ -109,4 +123,11 @@ def deserialize(cls, data):
             data["compression_xbzrle"],
             data["compression_xbzrle_cache"],
             data["multifd"],
-            data["multifd_channels"])
+            data["multifd_channels"],
+            data.get("multifd_compression", "none"),
+            data.get("mapped_ram", False),
+            data.get("dirty_limit", False),
+            data.get("x_vcpu_dirty_limit_period", 500),
+            data.get("vcpu_dirty_limit", 1),
+            data.get("dirty_percent", 100),
+            data.get("dirty_rate", 0))
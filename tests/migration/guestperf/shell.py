@@ -47,7 +47,8 @@ def __init__(self):
         parser.add_argument("--dst-host", dest="dst_host", default="localhost")
         parser.add_argument("--kernel", dest="kernel", default="/boot/vmlinuz-%s" % platform.release())
         parser.add_argument("--initrd", dest="initrd", default="tests/migration/initrd-stress.img")
-        parser.add_argument("--transport", dest="transport", default="unix")
+        parser.add_argument("--transport", dest="transport", default="unix",
+                            help="unix, tcp, rdma or file")
 
 
         # Hardware args
@@ -104,6 +105,9 @@ def __init__(self):
         parser = self._parser
 
         parser.add_argument("--output", dest="output", default=None)
+        parser.add_argument("--summary", dest="summary", default=False,
+                            action="store_true",
+                            help="only output the summary of the run")
 
         # Scenario args
         parser.add_argument("--max-iters", dest="max_iters", default=30, type=int)
@@ -130,6 +134,11 @@ def __init__(self):
                             action="store_true")
         parser.add_argument("--multifd-channels", dest="multifd_channels",
                             default=2, type=int)
+        parser.add_argument("--multifd-compression",
+                            dest="multifd_compression", default="none")
+
+        parser.add_argument("--mapped-ram", dest="mapped_ram", default=False,
+                            action="store_true")
 
         parser.add_argument("--dirty-limit", dest="dirty_limit", default=False,
                             action="store_true")
@@ -142,6 +151,15 @@ def __init__(self):
                             dest="vcpu_dirty_limit",
                             default=1, type=int)
 
+        # Guest workload args
+        parser.add_argument("--dirty-percent", dest="dirty_percent",
+                            default=100, type=int,
+                            help="percentage of guest RAM kept dirty")
+        parser.add_argument("--dirty-rate", dest="dirty_rate",
+                            default=0, type=int,
+                            help="MiB per second dirtied by each vCPU, "
+                                 "0 for no limit")
+
     def get_scenario(self, args):
         return Scenario(name="perfreport",
                         downtime=args.downtime,
@@ -166,11 +184,17 @@ def get_scenario(self, args):
 
                         multifd=args.multifd,
                         multifd_channels=args.multifd_channels,
+                        multifd_compression=args.multifd_compression,
+
+                        mapped_ram=args.mapped_ram,
 
                         dirty_limit=args.dirty_limit,
                         x_vcpu_dirty_limit_period=\
                             args.x_vcpu_dirty_limit_period,
-                        vcpu_dirty_limit=args.vcpu_dirty_limit)
+                        vcpu_dirty_limit=args.vcpu_dirty_limit,
+
+                        dirty_percent=args.dirty_percent,
+                        dirty_rate=args.dirty_rate)
 
     def run(self, argv):
         args = self._parser.parse_args(argv)
@@ -185,11 +209,15 @@ def run(self, argv):
 
         try:
             report = engine.run(hardware, scenario)
+            if args.summary:
+                output = report.summary_to_json()
+            else:
+                output = report.to_json()
             if args.output is None:
-                print(report.to_json())
+                print(output)
             else:
                 with open(args.output, "w") as fh:
-                    print(report.to_json(), file=fh)
+                    print(output, file=fh)
             return 0
         except Exception as e:
             print("Error: %s" % str(e), file=sys.stderr)
@@ -156,6 +156,14 @@ static unsigned long long now(void)
     return (tv.tv_sec * 1000ull) + (tv.tv_usec / 1000ull);
 }
 
+/*
+ * Only the first dirtypct percent of the RAM is rewritten, the rest
+ * stays untouched after being faulted in.  If dirtyrate is non-zero,
+ * each thread dirties at most that many MB per second.
+ */
+static unsigned long long dirtypct = 100;
+static unsigned long long dirtyrate;
+
 static void stressone(unsigned long long ramsizeMB)
 {
     size_t pagesPerMB = 1024 * 1024 / RAM_PAGE_SIZE;
@@ -165,7 +173,8 @@ static void stressone(unsigned long long ramsizeMB)
     g_autofree char *data = g_malloc(RAM_PAGE_SIZE);
     char *dataptr;
     size_t nMB = 0;
-    unsigned long long before, after;
+    size_t dirtyMB = MAX(ramsizeMB * dirtypct / 100, 1);
+    unsigned long long before, after, start, elapsed;
 
     /* We don't care about initial state, but we do want
      * to fault it all into RAM, otherwise the first iter
@@ -183,7 +192,8 @@ static void stressone(unsigned long long ramsizeMB)
     while (1) {
 
         ramptr = ram;
-        for (i = 0; i < ramsizeMB; i++, nMB++) {
+        start = now();
+        for (i = 0; i < dirtyMB; i++, nMB++) {
             for (j = 0; j < pagesPerMB; j++) {
                 dataptr = data;
                 for (k = 0; k < RAM_PAGE_SIZE; k += sizeof(long long)) {
@@ -200,6 +210,13 @@ static void stressone(unsigned long long ramsizeMB)
                 before = now();
                 nMB = 0;
             }
+
+            if (dirtyrate) {
+                elapsed = now() - start;
+                if (elapsed < (i + 1) * 1000 / dirtyrate) {
+                    g_usleep(((i + 1) * 1000 / dirtyrate - elapsed) * 1000);
+                }
+            }
         }
     }
 }
@@ -266,11 +283,13 @@ int main(int argc, char **argv)
     char *end;
     int ch;
     int opt_ind = 0;
-    const char *sopt = "hr:c:";
+    const char *sopt = "hr:c:p:d:";
     struct option lopt[] = {
         { "help", no_argument, NULL, 'h' },
         { "ramsize", required_argument, NULL, 'r' },
         { "cpus", required_argument, NULL, 'c' },
+        { "dirtypct", required_argument, NULL, 'p' },
+        { "dirtyrate", required_argument, NULL, 'd' },
         { NULL, 0, NULL, 0 }
     };
     int ret;
@@ -300,9 +319,30 @@ int main(int argc, char **argv)
             }
             break;
 
+        case 'p':
+            errno = 0;
+            dirtypct = strtoll(optarg, &end, 10);
+            if (errno != 0 || *end || dirtypct > 100) {
+                fprintf(stderr, "%s (%05d): ERROR: Cannot parse dirty percentage %s\n",
+                        argv0, gettid(), optarg);
+                exit_failure();
+            }
+            break;
+
+        case 'd':
+            errno = 0;
+            dirtyrate = strtoll(optarg, &end, 10);
+            if (errno != 0 || *end) {
+                fprintf(stderr, "%s (%05d): ERROR: Cannot parse dirty rate %s\n",
+                        argv0, gettid(), optarg);
+                exit_failure();
+            }
+            break;
+
         case '?':
         case 'h':
-            fprintf(stderr, "%s: [--help][--ramsize GB][--cpus N]\n", argv0);
+            fprintf(stderr, "%s: [--help][--ramsize GB][--cpus N]"
+                    "[--dirtypct PERCENT][--dirtyrate MB/s]\n", argv0);
             exit_failure();
         }
     }
@@ -314,6 +354,14 @@ int main(int argc, char **argv)
         ret = get_command_arg_ull("ramsize", &ramsizeGB);
         if (ret < 0)
             exit_failure();
+
+        ret = get_command_arg_ull("dirtypct", &dirtypct);
+        if (ret < 0 || dirtypct > 100)
+            exit_failure();
+
+        ret = get_command_arg_ull("dirtyrate", &dirtyrate);
+        if (ret < 0)
+            exit_failure();
     }
 
     if (ncpus == 0)
@@ -321,6 +369,13 @@ int main(int argc, char **argv)
 
     fprintf(stdout, "%s (%05d): INFO: RAM %llu GiB across %d CPUs\n",
             argv0, gettid(), ramsizeGB, ncpus);
+    if (dirtyrate) {
+        fprintf(stdout, "%s (%05d): INFO: dirtying %llu%% of RAM at %llu MB/s per CPU\n",
+                argv0, gettid(), dirtypct, dirtyrate);
+    } else {
+        fprintf(stdout, "%s (%05d): INFO: dirtying %llu%% of RAM\n",
+                argv0, gettid(), dirtypct);
+    }
 
     stress(ramsizeGB, ncpus);
 
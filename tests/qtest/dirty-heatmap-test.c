@@ -0,0 +1,116 @@
+/*
+ * QTest testcase for the dirty page heatmap
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
+#include "qapi/qmp/qnum.h"
+
+#define HEATMAP_PERIOD_MS       100
+#define HEATMAP_REGION_SIZE     (2 * 1024 * 1024)
+#define HEATMAP_TIMEOUT_US      (30 * 1000 * 1000)
+
+/* The guest physical address of the region that the test dirties */
+#define DIRTY_ADDR              (4 * 1024 * 1024)
+
+/* Return the value of statistic @name in a query-stats reply */
+static int64_t heatmap_stat(QDict *rsp, const char *name)
+{
+    QList *results = qdict_get_qlist(rsp, "return");
+    QListEntry *entry;
+    QDict *result;
+
+    g_assert_cmpint(qlist_size(results), ==, 1);
+    result = qobject_to(QDict, qlist_peek(results));
+    g_assert_cmpstr(qdict_get_str(result, "provider"), ==, "dirty-heatmap");
+
+    QLIST_FOREACH_ENTRY(qdict_get_qlist(result, "stats"), entry) {
+        QDict *stat = qobject_to(QDict, qlist_entry_obj(entry));
+
+        if (g_str_equal(qdict_get_str(stat, "name"), name)) {
+            return qdict_get_int(stat, "value");
+        }
+    }
+    g_assert_not_reached();
+}
+
+static void test_heatmap(void)
+{
+    QTestState *qts = qtest_init("-m 16M");
+    gint64 start_time = g_get_monotonic_time();
+    uint8_t pattern = 0;
+    QDict *rsp, *info;
+    QList *regions;
+    QDict *region;
+
+    qtest_qmp_assert_success(qts,
+        "{ 'execute': 'set-dirty-heatmap',"
+        "  'arguments': { 'enable': true, 'period': %d,"
+        "                 'sample-pages': 64 } }", HEATMAP_PERIOD_MS);
+
+    /*
+     * Keep rewriting one region, so that the last completed period
+     * always saw it change, until the heatmap reports it.
+     */
+    for (;;) {
+        qtest_memset(qts, DIRTY_ADDR, ++pattern, HEATMAP_REGION_SIZE);
+        g_usleep(HEATMAP_PERIOD_MS * 1000 / 2);
+
+        rsp = qtest_qmp_assert_success_ref(qts,
+            "{ 'execute': 'query-stats',"
+            "  'arguments': { 'target': 'vm',"
+            "                 'providers': ["
+            "                   { 'provider': 'dirty-heatmap' } ] } }");
+        if (heatmap_stat(rsp, "periods") > 0 &&
+            heatmap_stat(rsp, "dirty-regions") > 0) {
+            break;
+        }
+        qobject_unref(rsp);
+
+        g_assert(g_get_monotonic_time() - start_time <= HEATMAP_TIMEOUT_US);
+    }
+
+    g_assert_cmpint(heatmap_stat(rsp, "regions"), >, 0);
+    g_assert_cmpint(heatmap_stat(rsp, "working-set"), >=, HEATMAP_REGION_SIZE);
+    qobject_unref(rsp);
+
+    info = qtest_qmp_assert_success_ref(qts,
+        "{ 'execute': 'query-dirty-heatmap',"
+        "  'arguments': { 'ramblock': 'pc.ram', 'max-regions': 1 } }");
+    g_assert(qdict_get_bool(info, "enabled"));
+    g_assert_cmpint(qdict_get_int(info, "periods"), >, 0);
+    regions = qdict_get_qlist(info, "regions");
+    g_assert_cmpint(qlist_size(regions), ==, 1);
+    region = qobject_to(QDict, qlist_peek(regions));
+    g_assert_cmpstr(qdict_get_str(region, "ramblock"), ==, "pc.ram");
+    g_assert_cmpint(qdict_get_int(region, "offset"), ==, DIRTY_ADDR);
+    g_assert_cmpuint(qnum_get_uint(qobject_to(QNum,
+                                              qdict_get(region, "history"))),
+                     !=, 0);
+    qobject_unref(info);
+
+    info = qtest_qmp_assert_success_ref(qts,
+        "{ 'execute': 'query-dirty-heatmap',"
+        "  'arguments': { 'ramblock': 'no-such-block' } }");
+    g_assert(qlist_empty(qdict_get_qlist(info, "regions")));
+    qobject_unref(info);
+
+    qtest_qmp_assert_success(qts,
+        "{ 'execute': 'set-dirty-heatmap', 'arguments': { 'enable': false } }");
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/dirty-heatmap/sample", test_heatmap);
+
+    return g_test_run();
+}
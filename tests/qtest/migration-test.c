@@ -2228,6 +2228,138 @@ static void test_precopy_file_mapped_ram(void)
     test_file_common(&args, true);
 }
 
+/* Size of a mapped-ram ramblock header without the save UUID */
+#define MAPPED_RAM_HDR_BASE_SIZE 28
+#define MAPPED_RAM_HDR_UUID_SIZE 16
+
+/*
+ * Look for a mapped-ram ramblock header of @header_size bytes in the
+ * migration file, i.e. one whose bitmap starts right after it.
+ */
+static bool file_has_mapped_ram_header(size_t header_size)
+{
+    g_autofree char *path = g_strdup_printf("%s/%s", tmpfs, FILE_TEST_FILENAME);
+    g_autofree char *data = NULL;
+    size_t len, i;
+
+    g_assert(g_file_get_contents(path, &data, &len, NULL));
+
+    for (i = 0; i + MAPPED_RAM_HDR_BASE_SIZE <= len; i++) {
+        uint64_t page_size = ldq_be_p(data + i + 4);
+
+        if (ldl_be_p(data + i) == 1 &&
+            page_size >= 1024 && is_power_of_2(page_size) &&
+            ldq_be_p(data + i + 12) == i + header_size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void mapped_ram_old_header_end(QTestState *from, QTestState *to,
+                                      void *opaque)
+{
+    /*
+     * Without mapped-ram-incremental the ramblock headers are written
+     * without the save UUID, as by older QEMUs, and load as before.
+     */
+    g_assert_true(file_has_mapped_ram_header(MAPPED_RAM_HDR_BASE_SIZE));
+    g_assert_false(file_has_mapped_ram_header(MAPPED_RAM_HDR_BASE_SIZE +
+                                              MAPPED_RAM_HDR_UUID_SIZE));
+}
+
+static void test_precopy_file_mapped_ram_old_header(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = migrate_mapped_ram_start,
+        .finish_hook = mapped_ram_old_header_end,
+    };
+
+    test_file_common(&args, true);
+}
+
+/*
+ * Save the guest twice to the same file with mapped-ram-incremental, so
+ * that the second save only writes the pages dirtied since the first one,
+ * then load the result.  With @replace, the file is replaced between the
+ * two saves, and the second save must notice and write every page again.
+ */
+static void test_precopy_file_mapped_ram_incremental_common(bool replace)
+{
+    g_autofree char *path = g_strdup_printf("%s/%s", tmpfs, FILE_TEST_FILENAME);
+    g_autofree char *uri = g_strdup_printf("file:%s", path);
+    MigrateStart args = {};
+    QTestState *from, *to;
+    uint8_t byte_a, byte_b;
+
+    if (test_migrate_start(&from, &to, "defer", &args)) {
+        return;
+    }
+
+    migrate_mapped_ram_start(from, to);
+    migrate_set_capability(from, "mapped-ram-incremental", true);
+
+    migrate_ensure_converge(from);
+    wait_for_serial("src_serial");
+
+    qtest_qmp_assert_success(from, "{ 'execute' : 'stop'}");
+    wait_for_stop(from, &src_state);
+
+    migrate_qmp(from, to, uri, NULL, "{}");
+    wait_for_migration_complete(from);
+    g_assert_true(file_has_mapped_ram_header(MAPPED_RAM_HDR_BASE_SIZE +
+                                             MAPPED_RAM_HDR_UUID_SIZE));
+
+    if (replace) {
+        g_autofree char *data = NULL;
+        size_t len;
+
+        /*
+         * Same size but none of the first save's data.  The guest stays
+         * stopped, so only a full write gives back a working image.
+         */
+        g_assert(g_file_get_contents(path, &data, &len, NULL));
+        memset(data, 0, len);
+        g_assert(g_file_set_contents(path, data, len, NULL));
+    } else {
+        /* Let the guest dirty some of its memory before the second save */
+        qtest_qmp_assert_success(from, "{ 'execute' : 'cont'}");
+        qtest_memread(from, start_address, &byte_a, 1);
+        do {
+            usleep(1000 * 10);
+            qtest_memread(from, start_address, &byte_b, 1);
+        } while (byte_a == byte_b);
+        qtest_qmp_assert_success(from, "{ 'execute' : 'stop'}");
+    }
+
+    migrate_qmp(from, to, uri, NULL, "{}");
+    wait_for_migration_complete(from);
+
+    migrate_incoming_qmp(to, uri, "{}");
+    wait_for_migration_complete(to);
+
+    qtest_qmp_assert_success(to, "{ 'execute' : 'cont'}");
+    wait_for_resume(to, &dst_state);
+
+    wait_for_serial("dest_serial");
+
+    test_migrate_end(from, to, true);
+}
+
+static void test_precopy_file_mapped_ram_incremental(void)
+{
+    test_precopy_file_mapped_ram_incremental_common(false);
+}
+
+static void test_precopy_file_mapped_ram_incremental_replaced(void)
+{
+    test_precopy_file_mapped_ram_incremental_common(true);
+}
+
 static void *migrate_multifd_mapped_ram_start(QTestState *from, QTestState *to)
 {
     migrate_mapped_ram_start(from, to);
@@ -2932,6 +3064,15 @@ test_migrate_precopy_tcp_multifd_qatzip_start(QTestState *from,
 }
 #endif
 
+#ifdef CONFIG_LZ4
+static void *
+test_migrate_precopy_tcp_multifd_lz4_start(QTestState *from,
+                                           QTestState *to)
+{
+    return test_migrate_precopy_tcp_multifd_start_common(from, to, "lz4");
+}
+#endif /* CONFIG_LZ4 */
+
 #ifdef CONFIG_QPL
 static void *
 test_migrate_precopy_tcp_multifd_qpl_start(QTestState *from,
@@ -3040,6 +3181,17 @@ static void test_multifd_tcp_qatzip(void)
 }
 #endif
 
+#ifdef CONFIG_LZ4
+static void test_multifd_tcp_lz4(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_lz4_start,
+    };
+    test_precopy_common(&args);
+}
+#endif
+
 #ifdef CONFIG_QPL
 static void test_multifd_tcp_qpl(void)
 {
@@ -3838,6 +3990,12 @@ int main(int argc, char **argv)
                        test_precopy_file_mapped_ram);
     migration_test_add("/migration/precopy/file/mapped-ram/live",
                        test_precopy_file_mapped_ram_live);
+    migration_test_add("/migration/precopy/file/mapped-ram/old-header",
+                       test_precopy_file_mapped_ram_old_header);
+    migration_test_add("/migration/precopy/file/mapped-ram/incremental",
+                       test_precopy_file_mapped_ram_incremental);
+    migration_test_add("/migration/precopy/file/mapped-ram/incremental/replaced",
+                       test_precopy_file_mapped_ram_incremental_replaced);
 
     migration_test_add("/migration/multifd/file/mapped-ram",
                        test_multifd_file_mapped_ram);
@@ -3959,6 +4117,10 @@ int main(int argc, char **argv)
     migration_test_add("/migration/multifd/tcp/plain/qatzip",
                 test_multifd_tcp_qatzip);
 #endif
+#ifdef CONFIG_LZ4
+    migration_test_add("/migration/multifd/tcp/plain/lz4",
+                       test_multifd_tcp_lz4);
+#endif
 #ifdef CONFIG_QPL
     migration_test_add("/migration/multifd/tcp/plain/qpl",
                        test_multifd_tcp_qpl);
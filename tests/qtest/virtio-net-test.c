@@ -24,6 +24,7 @@
 #define PCI_SLOT                0x04
 
 #define QVIRTIO_NET_TIMEOUT_US (30 * 1000 * 1000)
+#define QVIRTIO_NET_COALESCE_USECS 1000
 #define VNET_HDR_SIZE sizeof(struct virtio_net_hdr_mrg_rxbuf)
 
 #ifndef _WIN32
@@ -144,6 +145,61 @@ static void rx_stop_cont_test(QVirtioDevice *dev,
     guest_free(alloc, req_addr);
 }
 
+/*
+ * With x-coalesce-max-usecs set, the used element must be visible right
+ * away but the interrupt must only be raised once the coalescing window,
+ * measured on the virtual clock, has expired.
+ */
+static void rx_coalesce_test(QVirtioDevice *dev,
+                             QGuestAllocator *alloc, QVirtQueue *vq,
+                             int socket)
+{
+    QTestState *qts = global_qtest;
+    uint64_t req_addr;
+    uint32_t free_head;
+    uint32_t desc_idx;
+    char test[] = "TEST";
+    int len = htonl(sizeof(test));
+    struct iovec iov[] = {
+        {
+            .iov_base = &len,
+            .iov_len = sizeof(len),
+        }, {
+            .iov_base = test,
+            .iov_len = sizeof(test),
+        },
+    };
+    gint64 start_time;
+    int ret;
+
+    req_addr = guest_alloc(alloc, 64);
+
+    free_head = qvirtqueue_add(qts, vq, req_addr, 64, true, false);
+    qvirtqueue_kick(qts, dev, vq, free_head);
+
+    ret = iov_send(socket, iov, 2, 0, sizeof(len) + sizeof(test));
+    g_assert_cmpint(ret, ==, sizeof(test) + sizeof(len));
+
+    /* Wait for the packet without advancing the virtual clock */
+    start_time = g_get_monotonic_time();
+    while (!qvirtqueue_get_buf(qts, vq, &desc_idx, NULL)) {
+        g_assert(g_get_monotonic_time() - start_time <=
+                 QVIRTIO_NET_TIMEOUT_US);
+        g_usleep(1000);
+    }
+    g_assert_cmpint(desc_idx, ==, free_head);
+
+    /* Half way through the window the interrupt is still held back */
+    qtest_clock_step(qts, QVIRTIO_NET_COALESCE_USECS * 1000 / 2);
+    g_assert(!dev->bus->get_queue_isr_status(dev, vq));
+
+    /* Past the deadline the coalescing timer delivers it */
+    qtest_clock_step(qts, QVIRTIO_NET_COALESCE_USECS * 1000);
+    g_assert(dev->bus->get_queue_isr_status(dev, vq));
+
+    guest_free(alloc, req_addr);
+}
+
 static void send_recv_test(void *obj, void *data, QGuestAllocator *t_alloc)
 {
     QVirtioNet *net_if = obj;
@@ -166,6 +222,16 @@ static void stop_cont_test(void *obj, void *data, QGuestAllocator *t_alloc)
     rx_stop_cont_test(dev, t_alloc, rx, sv[0]);
 }
 
+static void coalesce_test(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioNet *net_if = obj;
+    QVirtioDevice *dev = net_if->vdev;
+    QVirtQueue *rx = net_if->queues[0];
+    int *sv = data;
+
+    rx_coalesce_test(dev, t_alloc, rx, sv[0]);
+}
+
 static void hotplug(void *obj, void *data, QGuestAllocator *t_alloc)
 {
     QVirtioPCIDevice *dev = obj;
@@ -285,6 +351,14 @@ static void *virtio_net_test_setup(GString *cmd_line, void *arg)
     return sv;
 }
 
+static void *virtio_net_test_setup_coalesce(GString *cmd_line, void *arg)
+{
+    g_string_append_printf(cmd_line, " -global virtio-net-device."
+                           "x-coalesce-max-usecs=%d ",
+                           QVIRTIO_NET_COALESCE_USECS);
+    return virtio_net_test_setup(cmd_line, arg);
+}
+
 #endif /* _WIN32 */
 
 static void large_tx(void *obj, void *data, QGuestAllocator *t_alloc)
@@ -328,6 +402,8 @@ static void register_virtio_net_test(void)
     qos_add_test("basic", "virtio-net", send_recv_test, &opts);
     qos_add_test("rx_stop_cont", "virtio-net", stop_cont_test, &opts);
     qos_add_test("announce-self", "virtio-net", announce_self, &opts);
+    opts.before = virtio_net_test_setup_coalesce;
+    qos_add_test("rx_coalesce", "virtio-net", coalesce_test, &opts);
 #endif
 
     /* These tests do not need a loopback backend.  */
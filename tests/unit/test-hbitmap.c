@@ -396,6 +396,51 @@ static void test_hbitmap_reset_all(TestHBitmapData *data,
     hbitmap_test_reset_all(data);
     hbitmap_test_set(data, L3 / 2, L3);
     hbitmap_test_reset_all(data);
+    hbitmap_test_check_get(data);
+}
+
+static void test_hbitmap_merge(TestHBitmapData *data,
+                               const void *unused)
+{
+    static const struct {
+        uint64_t first, count;
+    } ranges[] = {
+        { 0, 1 }, { L1 - 1, 2 }, { L2 + 3, L1 * 2 }, { L3 - 1, L2 + 1 },
+        { L3 * 2 - 1, 1 },
+    };
+    HBitmap *src = hbitmap_alloc(L3 * 2, 0);
+    HBitmap *result = hbitmap_alloc(L3 * 2, 0);
+    HBitmap *dst;
+    int i;
+
+    hbitmap_test_init(data, L3 * 2, 0);
+    hbitmap_test_set(data, 1, L1);
+    hbitmap_test_set(data, L3, L1);
+
+    for (i = 0; i < ARRAY_SIZE(ranges); i++) {
+        hbitmap_set(src, ranges[i].first, ranges[i].count);
+    }
+
+    /* Merge into a third bitmap, which must not keep its old content */
+    hbitmap_set(result, L2, L2);
+    hbitmap_merge(data->hb, src, result);
+
+    /* Merge in place */
+    hbitmap_merge(data->hb, src, data->hb);
+    for (i = 0; i < ARRAY_SIZE(ranges); i++) {
+        bitmap_set(data->bits, ranges[i].first, ranges[i].count);
+    }
+    hbitmap_test_check(data, 0);
+    hbitmap_test_check_get(data);
+
+    dst = data->hb;
+    data->hb = result;
+    hbitmap_test_check(data, 0);
+    hbitmap_test_check_get(data);
+
+    data->hb = dst;
+    hbitmap_free(result);
+    hbitmap_free(src);
 }
 
 static void test_hbitmap_granularity(TestHBitmapData *data,
@@ -1061,6 +1106,7 @@ int main(int argc, char **argv)
     hbitmap_test_add("/hbitmap/reset/empty", test_hbitmap_reset_empty);
     hbitmap_test_add("/hbitmap/reset/general", test_hbitmap_reset);
     hbitmap_test_add("/hbitmap/reset/all", test_hbitmap_reset_all);
+    hbitmap_test_add("/hbitmap/merge", test_hbitmap_merge);
     hbitmap_test_add("/hbitmap/granularity", test_hbitmap_granularity);
 
     hbitmap_test_add("/hbitmap/truncate/nop", test_hbitmap_truncate_nop);
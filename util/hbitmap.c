@@ -583,15 +583,36 @@ void hbitmap_reset(HBitmap *hb, uint64_t start, uint64_t count)
     }
 }
 
-void hbitmap_reset_all(HBitmap *hb)
+/* Clear word @pos of @level and, recursively, all the nonzero words it
+ * covers in the levels below.
+ */
+static void hb_reset_word(HBitmap *hb, int level, size_t pos)
 {
-    unsigned int i;
+    unsigned long cur = hb->levels[level][pos];
 
-    /* Same as hbitmap_alloc() except for memset() instead of malloc() */
-    for (i = HBITMAP_LEVELS; --i >= 1; ) {
-        memset(hb->levels[i], 0, hb->sizes[i] * sizeof(unsigned long));
+    hb->levels[level][pos] = 0;
+    if (level == HBITMAP_LEVELS - 1) {
+        return;
     }
 
+    if (level == 0) {
+        /* Skip the sentinel */
+        cur &= ~(1UL << (BITS_PER_LONG - 1));
+    }
+    while (cur) {
+        hb_reset_word(hb, level + 1, (pos << BITS_PER_LEVEL) + ctzl(cur));
+        cur &= cur - 1;
+    }
+}
+
+void hbitmap_reset_all(HBitmap *hb)
+{
+    /* Only touch the words that have bits set, so that resetting a sparse
+     * bitmap does not depend on its size (and does not fault in pages of
+     * the lower levels that were never written to).
+     */
+    hb_reset_word(hb, 0, 0);
+
     hb->levels[0][0] = 1UL << (BITS_PER_LONG - 1);
     hb->count = 0;
 }
@@ -892,6 +913,36 @@ static void hbitmap_sparse_merge(HBitmap *dst, const HBitmap *src)
     }
 }
 
+/**
+ * hbitmap_merge_words: performs dst = dst | src
+ * for bitmaps with the same granularity, visiting only the nonzero words
+ * of src.
+ */
+static void hbitmap_merge_words(HBitmap *dst, const HBitmap *src)
+{
+    unsigned long *last_lev = dst->levels[HBITMAP_LEVELS - 1];
+    HBitmapIter hbi;
+    unsigned long cur, old;
+    size_t pos;
+
+    assert(dst->size == src->size);
+
+    hbitmap_iter_init(&hbi, src, 0);
+    for (;;) {
+        pos = hbitmap_iter_next_word(&hbi, &cur);
+        if (!cur) {
+            break;
+        }
+
+        old = last_lev[pos];
+        last_lev[pos] |= cur;
+        if (!old) {
+            hb_set_between(dst, HBITMAP_LEVELS - 2, pos, pos);
+        }
+        dst->count += ctpopl(last_lev[pos]) - ctpopl(old);
+    }
+}
+
 /**
  * Given HBitmaps A and B, let R := A (BITOR) B.
  * Bitmaps A and B will not be modified,
@@ -900,9 +951,6 @@ static void hbitmap_sparse_merge(HBitmap *dst, const HBitmap *src)
  */
 void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
 {
-    int i;
-    uint64_t j;
-
     assert(a->orig_size == result->orig_size);
     assert(b->orig_size == result->orig_size);
 
@@ -929,19 +977,20 @@ void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
         return;
     }
 
-    /* This merge is O(size), as BITS_PER_LONG and HBITMAP_LEVELS are constant.
-     * It may be possible to improve running times for sparsely populated maps
-     * by using hbitmap_iter_next, but this is suboptimal for dense maps.
+    /* The upper levels let us skip the words that are zero, so this merge
+     * is proportional to the number of nonzero words in the source bitmaps
+     * rather than to their size.
      */
     assert(a->size == b->size);
-    for (i = HBITMAP_LEVELS - 1; i >= 0; i--) {
-        for (j = 0; j < a->sizes[i]; j++) {
-            result->levels[i][j] = a->levels[i][j] | b->levels[i][j];
-        }
+    if ((a != result) && (b != result)) {
+        hbitmap_reset_all(result);
+    }
+    if (a != result) {
+        hbitmap_merge_words(result, a);
+    }
+    if (b != result) {
+        hbitmap_merge_words(result, b);
     }
-
-    /* Recompute the dirty count */
-    result->count = hb_count_between(result, 0, result->size - 1);
 }
 
 char *hbitmap_sha256(const HBitmap *bitmap, Error **errp)